@@ -0,0 +1,196 @@
+//=============================================================================
+// auxdet_aggregation_benchmark.cc: merging of the AuxDetSD steps into hits,
+// streaming (AuxDetHitAggregator) against buffer, sort and merge
+// (mergeSortedAuxDetSteps), on a synthetic CRT workload.
+//
+// Each event has cosmic muons crossing a few neighbouring strips of a plane
+// of scintillator strips, a few steps per strip; the muons knock out delta
+// electrons, which deposit in the strip (sometimes the next one) and may have
+// a secondary of their own. Steps come in Geant4 order: a track to its end,
+// then its secondaries, which are numbered after all the tracks before them.
+//
+// Prints the time per event of each method (steps recorded and merged) and
+// how many hits of the two methods differ (in one method only, or with
+// different contents; energies are compared to 1e-5 relative), with the
+// largest relative difference of energy, as one JSON record:
+//   auxdet_aggregation_benchmark [--events N] [--muons N] [--strips N]
+//                                [--repeat N] [--seed N]
+// The exit status is 1 if any hit differs, so that the benchmark also checks
+// that both methods agree.
+//=============================================================================
+#include "larg4/Services/AuxDetHitAggregator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+  struct Workload {
+    int events = 1000;
+    int muons = 20;      // per event
+    int strips = 256;    // copy numbers of the plane
+    int repeat = 5;      // passes over the events
+    unsigned seed = 12345;
+  };
+
+  class EventGenerator {
+  public:
+    EventGenerator(Workload const& w) : w_(w), engine_(w.seed) {}
+
+    TempHitCollection event()
+    {
+      TempHitCollection steps;
+      int nextTrack = w_.muons + 1;
+      for (int muon = 1; muon <= w_.muons; ++muon) {
+        struct Delta { int track, parent, strip; float t; };
+        std::vector<Delta> deltas;
+        int strip = uniform(0, w_.strips - 1);
+        int const nStrips = uniform(2, 6);
+        float t = 10.f * uniform01();
+        for (int s = 0; s < nStrips && strip < w_.strips; ++s, ++strip) {
+          track(steps, strip, muon, 0, uniform(3, 8), 0.2f, t);
+          if (uniform01() < 0.3) deltas.push_back({nextTrack++, muon, strip, t});
+        }
+        // -- then the secondaries, and their own secondaries
+        for (size_t i = 0; i < deltas.size(); ++i) {
+          Delta const d = deltas[i];
+          float t0 = d.t;
+          track(steps, d.strip, d.track, d.parent, uniform(2, 5), 0.05f, t0);
+          if (uniform01() < 0.1 && d.strip + 1 < w_.strips)
+            track(steps, d.strip + 1, d.track, d.parent, uniform(1, 3), 0.05f, t0);
+          if (uniform01() < 0.2) deltas.push_back({nextTrack++, d.track, d.strip, t0});
+        }
+      }
+      return steps;
+    }
+
+  private:
+    int uniform(int a, int b) { return std::uniform_int_distribution<int>(a, b)(engine_); }
+    double uniform01() { return std::uniform_real_distribution<double>(0., 1.)(engine_); }
+
+    // steps of a track in a strip, advancing the time t [ns]
+    void track(TempHitCollection& steps, int strip, int trackID, int parentID, int nSteps,
+               float edep, float& t)
+    {
+      float x = strip * 5.f;
+      for (int i = 0; i < nSteps; ++i) {
+        float const dt = 0.01f + 0.02f * uniform01();
+        steps.emplace_back(strip, trackID, parentID, i == 0, i == nSteps - 1,
+                           float(edep * (0.5 + uniform01())),
+                           x, 0.f, 0.f, t, x + 0.1f, 0.f, 0.f, t + dt,
+                           0.f, 0.f, 1.f);
+        x += 0.1f;
+        t += dt;
+      }
+    }
+
+    Workload w_;
+    std::mt19937 engine_;
+  };
+
+  bool before(sim::AuxDetHit const& a, sim::AuxDetHit const& b)
+  {
+    return (a.GetID() != b.GetID()) ? (a.GetID() < b.GetID()) : (a.GetTrackID() < b.GetTrackID());
+  }
+
+  double energyDifference(sim::AuxDetHit const& a, sim::AuxDetHit const& b)
+  {
+    return std::abs(a.GetEnergyDeposited() - b.GetEnergyDeposited()) / std::abs(b.GetEnergyDeposited());
+  }
+
+  bool sameHit(sim::AuxDetHit const& a, sim::AuxDetHit const& b)
+  {
+    return a.GetID() == b.GetID() && a.GetTrackID() == b.GetTrackID()
+      && energyDifference(a, b) <= 1e-5
+      && a.GetEntryT() == b.GetEntryT() && a.GetExitT() == b.GetExitT()
+      && a.GetExitX() == b.GetExitX() && a.GetExitMomentumZ() == b.GetExitMomentumZ();
+  }
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  Workload w;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string const flag = argv[i];
+    long const value = std::strtol(argv[i + 1], nullptr, 10);
+    if (flag == "--events") w.events = value;
+    else if (flag == "--muons") w.muons = value;
+    else if (flag == "--strips") w.strips = value;
+    else if (flag == "--repeat") w.repeat = value;
+    else if (flag == "--seed") w.seed = value;
+    else {
+      std::cerr << "Unknown option " << flag << "\n";
+      return 1;
+    }
+  }
+
+  EventGenerator generator(w);
+  std::vector<TempHitCollection> events;
+  size_t nSteps = 0;
+  for (int i = 0; i < w.events; ++i) {
+    events.push_back(generator.event());
+    nSteps += events.back().size();
+  }
+
+  using clock = std::chrono::steady_clock;
+  larg4::AuxDetHitAggregator aggregator;
+  TempHitCollection buffer;
+  std::vector<sim::AuxDetHitCollection> streamed(events.size()), sorted(events.size());
+  double streamingTime = 0., sortedTime = 0.;
+  for (int pass = 0; pass < w.repeat; ++pass) {
+    for (size_t e = 0; e < events.size(); ++e) {
+      streamed[e].clear();
+      auto const start = clock::now();
+      aggregator.clear();
+      for (TempHit const& step : events[e]) aggregator.add(step);
+      aggregator.finish(streamed[e]);
+      auto const middle = clock::now();
+      buffer.clear();
+      for (TempHit const& step : events[e]) buffer.push_back(step);
+      sorted[e].clear();
+      larg4::mergeSortedAuxDetSteps(buffer, sorted[e]);
+      auto const stop = clock::now();
+      streamingTime += std::chrono::duration<double>(middle - start).count();
+      sortedTime += std::chrono::duration<double>(stop - middle).count();
+    }
+  }
+
+  size_t nStreamed = 0, nSorted = 0, nDiffering = 0, eventsDiffering = 0;
+  double maxEnergyDifference = 0.;
+  for (size_t e = 0; e < events.size(); ++e) {
+    nStreamed += streamed[e].size();
+    nSorted += sorted[e].size();
+    // -- both are sorted by (copy number, track ID): walk them together
+    size_t differing = 0;
+    auto a = streamed[e].begin();
+    auto b = sorted[e].begin();
+    while (a != streamed[e].end() || b != sorted[e].end()) {
+      if (b == sorted[e].end() || (a != streamed[e].end() && before(*a, *b))) ++a, ++differing;
+      else if (a == streamed[e].end() || before(*b, *a)) ++b, ++differing;
+      else {
+        maxEnergyDifference = std::max(maxEnergyDifference, energyDifference(*a, *b));
+        differing += sameHit(*a++, *b++) ? 0 : 1;
+      }
+    }
+    nDiffering += differing;
+    if (differing) ++eventsDiffering;
+  }
+
+  double const passes = double(w.repeat) * w.events;
+  std::cout << "{\"workload\": \"crt\", \"events\": " << w.events << ", \"muons\": " << w.muons
+            << ", \"strips\": " << w.strips << ", \"steps_per_event\": " << double(nSteps) / w.events
+            << ", \"streaming_us_per_event\": " << 1e6 * streamingTime / passes
+            << ", \"sorted_us_per_event\": " << 1e6 * sortedTime / passes
+            << ", \"hits_streaming\": " << nStreamed << ", \"hits_sorted\": " << nSorted
+            << ", \"hits_differing\": " << nDiffering
+            << ", \"events_differing\": " << eventsDiffering
+            << ", \"max_energy_difference\": " << maxEnergyDifference << "}" << std::endl;
+  return (nDiffering > 0) ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""Throughput and scaling benchmark of larg4.
+
+Runs canned workloads (single muons, neutrons and pions, electromagnetic
+showers) on gdml/lArDet.gdml through fcl/benchmark_larg4.fcl, sweeping the
+number of primaries per event, and appends one JSON record per run to the
+output file:
+
+  schema                  format version of the record (bump on changes)
+  workload, multiplicity  what was simulated
+  events                  number of events processed
+  events_per_s            throughput of the event loop (TimeTracker)
+  job_wall_s              wall time of the whole art process
+  event_wall_s            per-event wall time percentiles p50/p90/p99/max
+                          [s], first event excluded (TimeTracker); it
+                          includes I/O and other waits, see cpu_s_per_event
+  cpu_s_per_event         user+system CPU time of the process per event
+  peak_rss_mb             peak resident memory of the process
+  output_bytes_per_event  size of the art/ROOT output per event
+
+Records are written with sorted keys, one per line, so results of two
+releases can be compared line by line or loaded with any JSON reader.
+The art runtime environment (art, FHICL_FILE_PATH, FW_SEARCH_PATH) must be
+set up.
+"""
+
+import argparse
+import json
+import os
+import platform
+import shutil
+import sqlite3
+import subprocess
+import sys
+import tempfile
+import time
+
+SCHEMA = 2
+
+# generator settings of each workload; the PDG list is repeated to reach the
+# requested multiplicity, the other vectors are padded by SingleGen
+WORKLOADS = {
+    "singlemu": {"PDG": [13], "P0": [6.0]},
+    "npi": {"PDG": [2112, -211], "P0": [0.1, 1.0],
+            "SigmaX": [10.0], "SigmaY": [10.0], "SigmaZ": [10.0], "Z0": [0.0]},
+    "shower": {"PDG": [11], "P0": [2.0], "SigmaX": [10.0], "SigmaY": [10.0]},
+}
+
+
+def fcl_value(value):
+    if isinstance(value, list):
+        return "[ " + ", ".join(fcl_value(v) for v in value) + " ]"
+    return repr(value)
+
+
+def job_fcl(workload, multiplicity, events):
+    settings = dict(WORKLOADS[workload])
+    pdg = settings.pop("PDG")
+    pdg = (pdg * multiplicity)[:max(multiplicity, 1)]
+    lines = ['#include "benchmark_larg4.fcl"',
+             "source.maxEvents: %d" % events,
+             "physics.producers.generator.PDG: " + fcl_value(pdg)]
+    for key, value in sorted(settings.items()):
+        if len(value) > 1:  # per-particle values follow the PDG list
+            value = (value * multiplicity)[:len(pdg)]
+        lines.append("physics.producers.generator.%s: %s" % (key, fcl_value(value)))
+    return "\n".join(lines) + "\n"
+
+
+def percentile(values, fraction):
+    if not values:
+        return None
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(round(fraction * (len(ordered) - 1))))]
+
+
+def run(art, workload, multiplicity, events, workdir):
+    with open(os.path.join(workdir, "job.fcl"), "w") as fcl:
+        fcl.write(job_fcl(workload, multiplicity, events))
+
+    start = time.monotonic()
+    with open(os.path.join(workdir, "job.log"), "w") as log:
+        process = subprocess.Popen([art, "-c", "job.fcl"], cwd=workdir,
+                                   stdout=log, stderr=subprocess.STDOUT)
+        _, status, usage = os.wait4(process.pid, 0)
+    wall = time.monotonic() - start
+    if status != 0:
+        raise RuntimeError("art failed for %s x%d, see %s"
+                           % (workload, multiplicity, os.path.join(workdir, "job.log")))
+
+    with sqlite3.connect(os.path.join(workdir, "larg4_benchmark_time.db")) as db:
+        times = [row[0] for row in db.execute("SELECT Time FROM TimeEvent")]
+    steady = times[1:] if len(times) > 1 else times
+    output = os.path.join(workdir, "larg4_benchmark.root")
+    n = len(times)
+
+    # ru_maxrss is in kilobytes on Linux, in bytes on macOS
+    rss_scale = 1.0 / 1024 if platform.system() != "Darwin" else 1.0 / (1024 * 1024)
+    return {
+        "schema": SCHEMA,
+        "workload": workload,
+        "multiplicity": multiplicity,
+        "events": n,
+        "events_per_s": n / sum(times) if n and sum(times) > 0 else None,
+        "job_wall_s": wall,
+        "event_wall_s": {"p50": percentile(steady, 0.50),
+                         "p90": percentile(steady, 0.90),
+                         "p99": percentile(steady, 0.99),
+                         "max": max(steady) if steady else None},
+        "cpu_s_per_event": (usage.ru_utime + usage.ru_stime) / n if n else None,
+        "peak_rss_mb": usage.ru_maxrss * rss_scale,
+        "output_bytes_per_event": os.path.getsize(output) / n if n else None,
+        "larg4_version": os.environ.get("LARG4_VERSION", "unknown"),
+        "host": platform.node(),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--workloads", default=",".join(sorted(WORKLOADS)),
+                        help="comma separated list among: " + ", ".join(sorted(WORKLOADS)))
+    parser.add_argument("--multiplicities", default="1,2,4,8,16",
+                        help="comma separated numbers of primaries per event")
+    parser.add_argument("--events", type=int, default=50, help="events per run")
+    parser.add_argument("--output", default="larg4_benchmark.jsonl",
+                        help="file the records are appended to")
+    parser.add_argument("--art", default="art", help="art executable")
+    parser.add_argument("--keep", action="store_true", help="keep the run directories")
+    args = parser.parse_args()
+
+    workloads = args.workloads.split(",")
+    for workload in workloads:
+        if workload not in WORKLOADS:
+            parser.error("unknown workload: " + workload)
+    multiplicities = [int(m) for m in args.multiplicities.split(",")]
+
+    with open(args.output, "a") as output:
+        for workload in workloads:
+            for multiplicity in multiplicities:
+                workdir = tempfile.mkdtemp(prefix="larg4bench_%s_%d_" % (workload, multiplicity))
+                record = run(args.art, workload, multiplicity, args.events, workdir)
+                line = json.dumps(record, sort_keys=True)
+                output.write(line + "\n")
+                output.flush()
+                print(line)
+                if not args.keep:
+                    shutil.rmtree(workdir, ignore_errors=True)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -3,6 +3,34 @@
 // larg4Main_module.cc replicates many GEANT programs' @main()@ driver. It
 // creates and initializes the run manager, controls the beginning and end of
 // events.
+//
+// The module stays a legacy art::EDProducer: the Geant4 kernel driven by
+// artg4tk::ArtG4RunManager is sequential, and the services it works with
+// (ActionHolderService, DetectorHolderService, ParticleListActionService,
+// LArG4DetectorService) are LEGACY services, which make art process one event
+// at a time anyway.
+//
+// If physicsTableCacheDir is set, the physics tables built at the first begin
+// run are stored in a subdirectory of it named after a hash of everything they
+// depend on (Geant4 version, configuration of the physics list services, EM
+// parameters, materials, production cuts, and the processes attached to each
+// particle with their models). Later jobs with the same configuration retrieve
+// them instead of building them again. Only the tables Geant4 itself can store
+// are cached, which in practice are the electromagnetic ones (energy loss,
+// range, lambda): the hadronic cross sections are still computed at every job.
+//
+// The Geant4 kernel (physics list, detector construction, user actions) is
+// set up at the first begin run only; later runs just start a new G4Run. The
+// G4 macro (G4MacroFile) is executed and the uiAtBeginRun terminal opened at
+// that first run only too, so commands given there hold for the whole job.
+// Set rebuildEachRun to true to set everything up again, macro and terminal
+// included, at every run.
+//
+// The time spent in the larg4 hooks is accounted by TimingRecorder:
+// timingLevel 0 turns it off, 1 (default) times the per-event hooks, 2 also
+// the per-track and per-step ones. With timingProduct the times of each event
+// are put in the event (instances "timingNames" and "timingSeconds"); a
+// summary table is printed at the end of the job.
 
 #include "nusimdata/SimulationBase/MCParticle.h"
 #include "nusimdata/SimulationBase/MCTruth.h"
@@ -13,6 +41,9 @@
 #include "art/Framework/Core/ModuleMacros.h"
 #include "art/Framework/Principal/Event.h"
 #include "art/Framework/Principal/Run.h"
+#include "art/Persistency/Provenance/ModuleDescription.h"
+#include "canvas/Persistency/Provenance/ProcessConfiguration.h"
+#include "fhiclcpp/ParameterSetRegistry.h"
 
 // Local includes (like actions)
 #include "artg4tk/geantInit/ArtG4RunManager.hh"
@@ -26,6 +57,11 @@
 #include "artg4tk/geantInit/ArtG4StackingAction.hh"
 #include "artg4tk/geantInit/ArtG4TrackingAction.hh"
 #include "larg4/pluginActions/ParticleListAction_service.h" // combined actions.
+#include "larg4/pluginActions/MCTruthEventAction_service.h"
+#include "larg4/Services/LArG4Detector_service.h"
+#include "larg4/Services/ContentHash.h"
+#include "larg4/Services/TimingRecorder.h"
+#include "larg4/Services/ProcessRegistry.h"
 
 // Services
 #include "art/Framework/Services/Registry/ServiceHandle.h"
@@ -46,9 +82,121 @@
 
 #include "Geant4/G4UImanager.hh"
 #include "Geant4/G4UIterminal.hh"
+#include "Geant4/G4VUserPhysicsList.hh"
+#include "Geant4/G4Material.hh"
+#include "Geant4/G4Element.hh"
+#include "Geant4/G4Region.hh"
+#include "Geant4/G4RegionStore.hh"
+#include "Geant4/G4ProductionCuts.hh"
+#include "Geant4/G4ProductionCutsTable.hh"
+#include "Geant4/G4ParticleTable.hh"
+#include "Geant4/G4ProcessManager.hh"
+#include "Geant4/G4ProcessVector.hh"
+#include "Geant4/G4EmParameters.hh"
+#include "Geant4/G4VEmModel.hh"
+#include "Geant4/G4VEmProcess.hh"
+#include "Geant4/G4VEnergyLossProcess.hh"
+#include "Geant4/G4VMultipleScattering.hh"
+#include "Geant4/G4Version.hh"
+
+#include "boost/filesystem.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
 
 using namespace std;
 
+namespace {
+
+  // Models of an EM process, with their energy ranges
+  template <typename Process>
+  void streamModels(std::ostream& key, Process const* process)
+  {
+    for (G4int i = 0; G4VEmModel* model = process->GetModelByIndex(i, false); ++i) {
+      key << ' ' << model->GetName() << '[' << model->LowEnergyLimit()
+          << ',' << model->HighEnergyLimit() << ']';
+    }
+  }
+
+  // Describes everything the physics tables are built from. Two jobs with
+  // the same description build identical tables. `physicsServices` is the
+  // configuration of the physics list services: EM constructors that
+  // register the same processes (e.g. _EMY and _EMZ) differ in their models
+  // and in the EM parameters, which are also part of the key.
+  std::string physicsTableKey(G4VUserPhysicsList const& physicsList,
+                              std::string const& physicsServices)
+  {
+    std::ostringstream key;
+    key << std::setprecision(17);
+    key << "geant4 " << G4VERSION_NUMBER << "\n";
+    key << "services " << physicsServices << "\n";
+    key << "defaultCut " << physicsList.GetDefaultCutValue() << "\n";
+    G4EmParameters::Instance()->StreamInfo(key);
+
+    for (G4Material const* material: *G4Material::GetMaterialTable()) {
+      key << "material " << material->GetName()
+          << ' ' << material->GetDensity()
+          << ' ' << material->GetState()
+          << ' ' << material->GetTemperature()
+          << ' ' << material->GetPressure()
+          << ' ' << material->GetIonisation()->GetMeanExcitationEnergy();
+      G4double const* fractions = material->GetFractionVector();
+      for (size_t i = 0; i < material->GetNumberOfElements(); ++i) {
+        key << ' ' << material->GetElement(i)->GetName() << ':' << fractions[i];
+      }
+      key << "\n";
+    }
+
+    G4ProductionCutsTable const* cutsTable = G4ProductionCutsTable::GetProductionCutsTable();
+    key << "cutsEnergyRange " << cutsTable->GetLowEdgeEnergy()
+        << ' ' << cutsTable->GetHighEdgeEnergy() << "\n";
+    for (G4Region const* region: *G4RegionStore::GetInstance()) {
+      key << "region " << region->GetName();
+      if (G4ProductionCuts const* cuts = region->GetProductionCuts()) {
+        for (G4double cut: cuts->GetProductionCuts()) key << ' ' << cut;
+      }
+      key << "\n";
+    }
+
+    auto* particleIterator = G4ParticleTable::GetParticleTable()->GetIterator();
+    particleIterator->reset();
+    while ((*particleIterator)()) {
+      G4ParticleDefinition const* particle = particleIterator->value();
+      G4ProcessManager const* processManager = particle->GetProcessManager();
+      if (!processManager) continue;
+      key << "particle " << particle->GetParticleName();
+      G4ProcessVector const* processes = processManager->GetProcessList();
+      G4int const nProcesses = processes->size();
+      for (G4int i = 0; i < nProcesses; ++i) {
+        G4VProcess const* process = (*processes)[i];
+        key << ' ' << process->GetProcessName();
+        if (auto const* eloss = dynamic_cast<G4VEnergyLossProcess const*>(process)) streamModels(key, eloss);
+        else if (auto const* em = dynamic_cast<G4VEmProcess const*>(process)) streamModels(key, em);
+        else if (auto const* msc = dynamic_cast<G4VMultipleScattering const*>(process)) streamModels(key, msc);
+      }
+      key << "\n";
+    }
+    return key.str();
+  }
+
+  // Last line of the stamp of a complete physics table cache entry
+  std::string const cacheComplete = "\ncomplete\n";
+
+  std::string readFile(std::string const& path)
+  {
+    std::ifstream in(path);
+    std::ostringstream content;
+    content << in.rdbuf();
+    return content.str();
+  }
+
+} // namespace
+
 namespace larg4 {
 
   // Define the producer
@@ -60,6 +208,7 @@ namespace larg4 {
   private:
     virtual void produce(art::Event & e) override;
     virtual void beginJob() override;
+    virtual void endJob() override;
     virtual void beginRun(art::Run &r) override;
     virtual void endRun(art::Run &) override;
 
@@ -88,7 +237,8 @@ namespace larg4 {
     // Initialized based on macroPath_.
     cet::search_path pathFinder_;
 
-    // Name of the Geant4 macro file, if provided
+    // Name of the Geant4 macro file, if provided; executed at the begin runs
+    // which set up the kernel
     string g4MacroFile_;
 
     // Boolean to determine whether we pause execution after each event
@@ -100,7 +250,8 @@ namespace larg4 {
     // Run diagnostic level (verbosity)
     int rmvlevel_;
 
-    // When to pop up user interface
+    // When to pop up user interface (uiAtBeginRun: at the begin runs which set
+    // up the kernel, i.e. the first one unless rebuildEachRun)
     bool uiAtBeginRun_;
     bool uiAtEndEvent_; // set by afterEvent in FHICL
 
@@ -111,6 +262,31 @@ namespace larg4 {
     //     ui    -- show the UI at the end of the event
     std::string afterEvent_;
 
+    // Split the primaries of one art event into several Geant4 events
+    //     none   -- one Geant4 event per art event
+    //     handle -- one Geant4 event per MCTruth handle
+    //     chunks -- balanced chunks of at most maxPrimariesPerSubEvent primaries
+    // The sub-events share one particle list (track IDs are offset past the
+    // previous sub-events) and their hits are merged into one set of products.
+    // They are simulated one after another. Only the SimEnergyDeposit and
+    // AuxDet detectors offset their track IDs: other (artg4tk) detectors are
+    // refused with sub-events.
+    std::string subEventMode_;
+    size_t maxPrimariesPerSubEvent_;
+
+    // Physics table cache (disabled if empty)
+    std::string physicsTableCacheDir_;
+    G4VUserPhysicsList* physicsList_; // owned by the run manager
+
+    // Whether to set up physics, geometry and actions again at each run
+    // (false: the Geant4 kernel initialized at the first run is reused)
+    bool rebuildEachRun_;
+    bool kernelInitialized_;
+
+    // Hook timing: level (see TimingRecorder) and whether to put it in the events
+    int timingLevel_;
+    bool timingProduct_;
+
     // Message logger
     mf::LogInfo logInfo_;
     //    bool fSparsifyTrajectories; ///< Sparsify MCParticle Trajectories
@@ -134,10 +310,23 @@ larg4::larg4Main::larg4Main(fhicl::ParameterSet const & p)
   uiAtBeginRun_( p.get<bool>("uiAtBeginRun", false)),
   uiAtEndEvent_(false),
   afterEvent_( p.get<std::string>("afterEvent", "pass")),
+  subEventMode_( p.get<std::string>("subEventMode", "none")),
+  maxPrimariesPerSubEvent_( p.get<size_t>("maxPrimariesPerSubEvent", 0)),
+  physicsTableCacheDir_( p.get<std::string>("physicsTableCacheDir", "")),
+  physicsList_(nullptr),
+  rebuildEachRun_( p.get<bool>("rebuildEachRun", false)),
+  kernelInitialized_(false),
+  timingLevel_( p.get<int>("timingLevel", TimingRecorder::kEvent)),
+  timingProduct_( p.get<bool>("timingProduct", false)),
   logInfo_("larg4Main")
 {
   produces< std::vector<simb::MCParticle> >();
   produces< art::Assns<simb::MCTruth, simb::MCParticle, sim::GeneratedParticleInfo> >();
+  if (timingProduct_) {
+    produces< std::vector<std::string> >("timingNames");
+    produces< std::vector<double> >("timingSeconds");
+  }
+  TimingRecorder::instance().setLevel(timingLevel_);
 
   // We need all of the services to run @produces@ on the data they will store. We do this
   // by retrieving the holder services.
@@ -165,6 +354,33 @@ larg4::larg4Main::larg4Main(fhicl::ParameterSet const & p)
   // Set up the random number engine.
   // -- D.R.: Use the NuRandomService engine for additional control over the seed generation policy
   (void)art::ServiceHandle<rndm::NuRandomService>()->createEngine(*this,"G4Engine",p,"seed");
+  // -- engine of the analytic scintillation fluctuations of the SimEnergyDeposit
+  //    detectors, only created (and seeded) if one of them draws fluctuations
+  art::ServiceHandle<LArG4DetectorService> detectorService;
+  if (detectorService->usesRandomEngine()) {
+    auto& scintEngine = art::ServiceHandle<rndm::NuRandomService>()
+      ->createEngine(*this, "HepJamesRandom", "ScintEngine", p, "scintillationSeed");
+    detectorService->setRandomEngine(&scintEngine);
+  }
+
+  if (subEventMode_ != "none" && subEventMode_ != "handle" && subEventMode_ != "chunks") {
+    throw cet::exception("larg4Main") << "Invalid subEventMode: " << subEventMode_
+                                      << " (allowed: none, handle, chunks)\n";
+  }
+  if (subEventMode_ == "chunks" && maxPrimariesPerSubEvent_ == 0) {
+    throw cet::exception("larg4Main") << "subEventMode: chunks requires maxPrimariesPerSubEvent > 0\n";
+  }
+  if (subEventMode_ != "none") {
+    // -- the hits of these detectors would carry the track IDs of their
+    //    sub-event, colliding with each other and with the MCParticles
+    auto const sds = detectorService->sdsWithoutTrackIDOffset();
+    if (!sds.empty()) {
+      cet::exception e("larg4Main");
+      e << "subEventMode: " << subEventMode_ << " does not support the sensitive detectors";
+      for (auto const& sd : sds) e << " " << sd;
+      throw e << " (their hits keep per-sub-event track IDs)\n";
+    }
+  }
 
   // Handle the afterEvent setting
   if ( afterEvent_ == "ui" ) {
@@ -184,12 +400,50 @@ void larg4::larg4Main::beginJob()
   runManager_.reset( new artg4tk::ArtG4RunManager );
 }
 
+// At end job
+void larg4::larg4Main::endJob()
+{
+  if (timingLevel_ <= TimingRecorder::kOff) return;
+
+  std::int64_t nEvents = 0;
+  auto const summary = TimingRecorder::instance().summary(nEvents);
+  std::ostringstream table;
+  table << "Time spent in the larg4 hooks over " << nEvents << " event(s):\n"
+        << std::left << std::setw(60) << "hook" << std::right
+        << std::setw(12) << "calls" << std::setw(14) << "total [s]" << std::setw(15) << "per event [ms]" << "\n";
+  for (auto const& [name, calls, seconds]: summary) {
+    table << std::left << std::setw(60) << name << std::right
+          << std::setw(12) << calls
+          << std::setw(14) << std::fixed << std::setprecision(3) << seconds
+          << std::setw(15) << (nEvents ? 1e3 * seconds / nEvents : 0.) << "\n";
+  }
+  mf::LogInfo("larg4Main") << table.str();
+}
+
 // At begin run
 void larg4::larg4Main::beginRun(art::Run & r)
 {
+  auto const startTime = std::chrono::steady_clock::now();
+
+  // Geometry and physics list come from job-level services and cannot change
+  // between the runs of a job: unless asked to rebuild, the kernel set up at
+  // the first run is kept and only the run bookkeeping is redone. The macro
+  // and the UI terminal are not applied again either.
+  if (kernelInitialized_ && !rebuildEachRun_) {
+    art::ServiceHandle<ActionHolderService> actionHolder;
+    actionHolder->setCurrArtRun(r);
+    runManager_ -> BeamOnBeginRun(r.id().run());
+
+    std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - startTime;
+    logInfo_ << "Geant4 initialization for run " << r.id().run() << " took "
+             << elapsed.count() << " s (kernel reused)\n";
+    return;
+  }
+
   // Get the physics list and pass it to Geant and initialize the list if necessary
   art::ServiceHandle<PhysicsListHolderService const> physicsListHolder;
-  runManager_->SetUserInitialization( physicsListHolder->makePhysicsList() );
+  physicsList_ = physicsListHolder->makePhysicsList();
+  runManager_->SetUserInitialization( physicsList_ );
 
   // Get all of the detectors and initialize them
   // Declare the detector construction to Geant
@@ -219,6 +473,9 @@ void larg4::larg4Main::beginRun(art::Run & r)
   runManager_->Initialize();
   physicsListHolder->initializePhysicsList();
 
+  // All the processes exist now: classify them once for the per-step lookups
+  ProcessRegistry::instance().build(art::ServiceHandle<ParticleListActionService>()->NotStoredPhysics());
+
   //get the pointer to the User Interface manager
   UI_ = G4UImanager::GetUIpointer();
 
@@ -251,13 +508,84 @@ void larg4::larg4Main::beginRun(art::Run & r)
     delete session_;
   }
 
+  // Look for physics tables built by an earlier job with the same
+  // configuration. The key is computed after the macro, which may change cuts.
+  std::string cacheKey, cacheEntry;
+  bool cacheHit = false;
+  if (!physicsTableCacheDir_.empty()) {
+    // -- the physics list services, from the configuration of the process
+    fhicl::ParameterSet processPSet, physicsServices;
+    if (fhicl::ParameterSetRegistry::get(moduleDescription().processConfiguration().parameterSetID(), processPSet)) {
+      for (std::string const service: {"PhysicsListHolder", "PhysicsList"}) {
+        physicsServices.put(service, processPSet.get<fhicl::ParameterSet>("services." + service, {}));
+      }
+    }
+    cacheKey = physicsTableKey(*physicsList_, physicsServices.to_compact_string());
+    cacheEntry = physicsTableCacheDir_ + "/" + contentHash(cacheKey);
+    // -- the stamp holds the key and a completion marker, and is written
+    //    last: an entry without it (or with a different key, should the
+    //    hashes collide) is incomplete or stale and is not used
+    std::string const stamp = cacheEntry + "/larg4.stamp";
+    bool const stampFound = boost::filesystem::exists(stamp);
+    cacheHit = stampFound && readFile(stamp) == cacheKey + cacheComplete;
+    if (cacheHit) {
+      physicsList_->SetPhysicsTableRetrieved(cacheEntry);
+    }
+    else if (stampFound) {
+      // -- entries are never replaced: this one stays in the way until removed
+      mf::LogWarning("larg4Main") << "Physics table cache entry " << cacheEntry
+        << " was stored for another configuration (stale or colliding stamp): building the"
+        << " tables at every job until the entry is removed";
+    }
+    logInfo_ << "Physics table cache entry " << cacheEntry << ": "
+             << (cacheHit ? "found, retrieving tables" : "not found, building tables") << "\n";
+  }
+
   // Start the Geant run!
   runManager_ -> BeamOnBeginRun(r.id().run());
+
+  // Store freshly built tables. They are written to a private directory and
+  // renamed into place only if no entry exists yet: an entry is never
+  // removed or replaced, so a concurrent job that has just published the
+  // same tables (or is reading them) is left alone.
+  if (!physicsTableCacheDir_.empty() && !cacheHit) {
+    std::string const tmpEntry = cacheEntry + ".tmp" + std::to_string(getpid());
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(tmpEntry, ec);
+    bool stored = false;
+    if (!ec && physicsList_->StorePhysicsTable(tmpEntry)) {
+      std::ofstream stampFile(tmpEntry + "/larg4.stamp");
+      stampFile << cacheKey << cacheComplete;
+      stampFile.close();
+      if (stampFile) {
+        // -- rename(2) does not replace a non-empty directory: another job
+        //    got there first, and its entry is as good as ours
+        stored = (::rename(tmpEntry.c_str(), cacheEntry.c_str()) == 0)
+          || errno == EEXIST || errno == ENOTEMPTY;
+      }
+    }
+    if (!stored) {
+      mf::LogWarning("larg4Main") << "Could not store physics tables in " << cacheEntry;
+    }
+    boost::filesystem::remove_all(tmpEntry, ec);
+  }
+  kernelInitialized_ = true;
+
+  std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - startTime;
+  logInfo_ << "Geant4 initialization for run " << r.id().run() << " took "
+           << elapsed.count() << " s (physics tables "
+           << (physicsTableCacheDir_.empty() ? "built, cache disabled" :
+               cacheHit ? "retrieved from cache" : "built and stored") << ")\n";
 }
 
 // Produce the Geant event
 void larg4::larg4Main::produce(art::Event & e)
 {
+  TimingRecorder::instance().beginEvent();
+  static int const produceSlot = TimingRecorder::instance().slot("larg4Main/produce");
+  static int const geant4Slot = TimingRecorder::instance().slot("larg4Main/Geant4 event");
+  ScopedTimer produceTimer(produceSlot);
+
   // The holder services need the event
   art::ServiceHandle<ActionHolderService> actionHolder;
   art::ServiceHandle<DetectorHolderService> detectorHolder;
@@ -267,18 +595,58 @@ void larg4::larg4Main::produce(art::Event & e)
   pla -> setCurrArtEvent(e);
   pla -> setProductID( e.getProductID<std::vector<simb::MCParticle>>());
 
-  // Begin event
-  runManager_ -> BeamOnDoOneEvent(e.id().event());
+  std::vector<std::pair<size_t, size_t>> subEvents;
+  if (subEventMode_ != "none") {
+    subEvents = art::ServiceHandle<MCTruthEventActionService>()
+      ->subEventRanges(e, subEventMode_, maxPrimariesPerSubEvent_);
+  }
 
-  //  logInfo_ << "Producing event " << e.id().event() << "\n" << endl;
+  if (subEvents.size() < 2) {
+    ScopedTimer geant4Timer(geant4Slot);
 
-  // Done with the event
-  runManager_ -> BeamOnEndEvent();
+    // Begin event
+    runManager_ -> BeamOnDoOneEvent(e.id().event());
+
+    //  logInfo_ << "Producing event " << e.id().event() << "\n" << endl;
+
+    // Done with the event
+    runManager_ -> BeamOnEndEvent();
+  }
+  else {
+    // Simulate the primaries as a sequence of Geant4 events; products are
+    // put at the end of the last one
+    art::ServiceHandle<MCTruthEventActionService> mcTruthAction;
+    art::ServiceHandle<LArG4DetectorService> detector;
+    for (size_t i = 0; i < subEvents.size(); ++i) {
+      bool const first = (i == 0);
+      bool const last = (i + 1 == subEvents.size());
+      mcTruthAction -> setPrimaryRange(subEvents[i].first, subEvents[i].second);
+      pla -> setSubEvent(first, last);
+      detector -> setSubEvent(first, last, ParticleListActionService::GetTrackIDOffset());
+      mf::LogDebug("larg4Main") << "Sub-event " << (i+1) << " of " << subEvents.size()
+                                << ", primaries [" << subEvents[i].first << ", "
+                                << subEvents[i].second << ")";
+      ScopedTimer geant4Timer(geant4Slot);
+      runManager_ -> BeamOnDoOneEvent(e.id().event());
+      runManager_ -> BeamOnEndEvent();
+    }
+    mcTruthAction -> resetPrimaryRange();
+    pla -> setSubEvent(true, true);
+    detector -> setSubEvent(true, true, 0);
+  }
 
   auto  &partCol=pla->GetParticleCollection();
   auto &tpassn = pla->GetAssnsMCTruthToMCParticle();
   e.put(std::move(partCol));
   e.put(std::move(tpassn));
+
+  if (timingProduct_) {
+    auto names = std::make_unique<std::vector<std::string>>();
+    auto seconds = std::make_unique<std::vector<double>>();
+    TimingRecorder::instance().eventTimes(*names, *seconds);
+    e.put(std::move(names), "timingNames");
+    e.put(std::move(seconds), "timingSeconds");
+  }
 }
 
 // At end run
@@ -0,0 +1,99 @@
+//=============================================================================
+// AuxDetChannelMap.cc: dense readout channels of the auxiliary detectors
+//=============================================================================
+#include "larg4/Services/AuxDetChannelMap.h"
+#include "cetlib_except/exception.h"
+
+#include "Geant4/G4LogicalVolume.hh"
+#include "Geant4/G4VPhysicalVolume.hh"
+#include "Geant4/G4VTouchable.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+namespace {
+  std::uint64_t key(G4VPhysicalVolume const* volume)
+  {
+    return reinterpret_cast<std::uintptr_t>(volume);
+  }
+}
+
+namespace larg4 {
+
+  AuxDetChannelMap::AuxDetChannelMap(G4VPhysicalVolume const* world,
+                                     std::set<G4LogicalVolume const*> const& sensitive,
+                                     std::set<G4LogicalVolume const*> auxDets)
+    : sensitive_(sensitive)
+    , auxDets_(std::move(auxDets))
+  {
+    if (auxDets_.empty()) {
+      // -- the mothers of the sensitive volumes
+      std::vector<G4LogicalVolume const*> stack{world->GetLogicalVolume()};
+      std::set<G4LogicalVolume const*> seen;
+      while (!stack.empty()) {
+        G4LogicalVolume const* volume = stack.back();
+        stack.pop_back();
+        if (!seen.insert(volume).second) continue;
+        for (size_t i = 0; i < size_t(volume->GetNoDaughters()); ++i) {
+          G4LogicalVolume const* daughter = volume->GetDaughter(i)->GetLogicalVolume();
+          if (sensitive_.count(daughter)) auxDets_.insert(volume);
+          stack.push_back(daughter);
+        }
+      }
+    }
+
+    nAuxDets_ = count(world->GetLogicalVolume()).auxDets;
+    for (G4LogicalVolume const* auxDet : auxDets_) {
+      auto const it = counts_.find(auxDet);
+      if (it != counts_.end()) stride_ = std::max(stride_, it->second.sensitive);
+    }
+    counts_.clear();
+  }
+
+  AuxDetChannelMap::Counts AuxDetChannelMap::count(G4LogicalVolume const* volume)
+  {
+    auto const it = counts_.find(volume);
+    if (it != counts_.end()) return it->second;
+
+    bool const isAuxDet = auxDets_.count(volume) > 0;
+    Counts total{sensitive_.count(volume) ? 1u : 0u, isAuxDet ? 1u : 0u};
+    for (size_t i = 0; i < size_t(volume->GetNoDaughters()); ++i) {
+      G4VPhysicalVolume const* daughter = volume->GetDaughter(i);
+      Counts const c = count(daughter->GetLogicalVolume());
+      unsigned int const copies = std::max(daughter->GetMultiplicity(), 1);
+      index_.insert(key(daughter), placements_.size());
+      placements_.push_back({auxDets_.count(daughter->GetLogicalVolume()) > 0,
+                             copies > 1,
+                             total.sensitive, c.sensitive,
+                             total.auxDets, c.auxDets});
+      total.sensitive += copies * c.sensitive;
+      // -- the AuxDets inside an AuxDet are not counted
+      if (!isAuxDet) total.auxDets += copies * c.auxDets;
+    }
+    counts_[volume] = total;
+    return total;
+  }
+
+  unsigned int AuxDetChannelMap::channel(G4VTouchable const* touchable) const
+  {
+    unsigned int sensitive = 0;
+    unsigned int auxDet = 0;
+    bool above = false;  // above the AuxDet level
+    int const depth = touchable->GetHistoryDepth(); // the world is at this depth
+    for (int level = 0; level < depth; ++level) {
+      std::uint32_t const i = index_.find(key(touchable->GetVolume(level)));
+      if (i == FlatIndexMap::npos) {
+        throw cet::exception("AuxDetChannelMap") << "Volume " << touchable->GetVolume(level)->GetName()
+                                                 << " is not in the channel map\n";
+      }
+      Placement const& p = placements_[i];
+      unsigned int const copy = p.replicated ? touchable->GetReplicaNumber(level) : 0;
+      above = above || p.auxDet;
+      if (above) auxDet += p.auxDetOffset + copy * p.auxDetCount;
+      else sensitive += p.sensitiveOffset + copy * p.sensitiveCount;
+    }
+    return auxDet * stride_ + sensitive;
+  }
+
+} // namespace larg4
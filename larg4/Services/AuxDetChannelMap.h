@@ -0,0 +1,87 @@
+// AuxDetChannelMap.h
+//
+// Dense readout channels of the auxiliary detectors, for geometries where an
+// AuxDet (e.g. a CRT module) contains several sensitive volumes (strips,
+// bars), possibly at different depths and placed through the same logical
+// volumes many times.
+//
+// The AuxDets are the logical volumes with the GDML auxiliary "AuxDet" (any
+// value); if no volume has it, the mothers of the sensitive volumes. Each
+// placement of an AuxDet in the world gets an index 0..nAuxDets()-1, and
+// each placement of a sensitive volume inside it an index
+// 0..sensitivePerAuxDet()-1, both in the order of the daughters of the
+// volume tree. The channel of a step is
+//   auxDet * sensitivePerAuxDet() + sensitive
+//
+// The map is built once from the volume tree: each physical volume holds its
+// offset among the sensitive volumes (below the AuxDet level) or AuxDets
+// (above it) of its mother, and the number of them in its own subtree, for
+// replicas. A channel is the sum of the offsets of the volumes of the
+// touchable history: one hash lookup by volume pointer per level, no names.
+
+#ifndef LARG4_AUXDETCHANNELMAP_H
+#define LARG4_AUXDETCHANNELMAP_H
+
+#include "larg4/Services/AuxDetHitAggregator.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+class G4LogicalVolume;
+class G4VPhysicalVolume;
+class G4VTouchable;
+
+namespace larg4 {
+
+  class AuxDetChannelMap {
+  public:
+    struct Channel {
+      unsigned int auxDet;
+      unsigned int sensitive;
+    };
+
+    /// `sensitive`: the sensitive volumes; `auxDets`: the AuxDet volumes
+    /// (empty: the mothers of the sensitive volumes)
+    AuxDetChannelMap(G4VPhysicalVolume const* world,
+                     std::set<G4LogicalVolume const*> const& sensitive,
+                     std::set<G4LogicalVolume const*> auxDets);
+
+    /// Channel of the volume at the bottom of a touchable history (a
+    /// sensitive volume, e.g. of the pre-step point)
+    unsigned int channel(G4VTouchable const* touchable) const;
+
+    Channel decode(unsigned int channel) const { return {channel / stride_, channel % stride_}; }
+
+    unsigned int nAuxDets() const { return nAuxDets_; }
+    unsigned int sensitivePerAuxDet() const { return stride_; }
+
+  private:
+    struct Placement {
+      bool auxDet;                 // the volume is an AuxDet
+      bool replicated;             // several copies (replica, parameterised)
+      unsigned int sensitiveOffset;
+      unsigned int sensitiveCount; // sensitive volumes in one copy
+      unsigned int auxDetOffset;
+      unsigned int auxDetCount;    // AuxDets in one copy
+    };
+
+    struct Counts {
+      unsigned int sensitive;
+      unsigned int auxDets;
+    };
+
+    Counts count(G4LogicalVolume const* volume);
+
+    std::set<G4LogicalVolume const*> sensitive_;
+    std::set<G4LogicalVolume const*> auxDets_;
+    std::map<G4LogicalVolume const*, Counts> counts_;  // construction only
+    FlatIndexMap index_;                                // physical volume -> placement
+    std::vector<Placement> placements_;
+    unsigned int nAuxDets_ = 0;
+    unsigned int stride_ = 1;
+  };
+
+} // namespace larg4
+
+#endif // LARG4_AUXDETCHANNELMAP_H
@@ -0,0 +1,353 @@
+// AuxDetHitAggregator.h
+//
+// Merging of the steps in auxiliary detectors into sim::AuxDetHit: one hit
+// per detector (copy number) and track, which also collects the energy of
+// the descendants of the track in that detector. Header only and free of
+// Geant4, so that AuxDetSD and benchmark/auxdet_aggregation_benchmark.cc use
+// the same code.
+//
+// mergeSortedAuxDetSteps sorts the steps by (copy number, track ID, exit
+// time) and merges them: the steps of a track make a hit, with entry point
+// from its first step, exit point from its last step with a nonzero exit
+// time and exit momentum from its first step; a track whose parent is in the
+// current hit adds its energy to it, else it starts a new hit.
+//
+// AuxDetHitAggregator gives the same hits up to rounding, without keeping
+// the steps: each step is added to a running partial hit of its (copy
+// number, track), found in a flat hash, and the merge runs at the end of the
+// event on the partial hits, one per track and detector instead of one per
+// step. Steps of a track come in time order, so the first and last ones of
+// the partial are those of the sorted merge. Hits, tracks and points are
+// the same; the energy of a descendant is added to its ancestor's hit as the
+// sum of its steps rather than step by step, so the float energies can
+// differ in the last bits (a few 1e-7 relative). The sorted merge does not
+// fix the order of these additions either: std::sort leaves the steps of a
+// track with equal exit times in any order.
+//
+// Which hit a descendant joins depends on the track IDs in between in the
+// sorted order, known only at the end of the event, which is why the partial
+// hits are not merged into their ancestor as they come.
+//
+// AuxDetTimeWindowAggregator also splits the hits in time: a hit only holds
+// the steps of a track, and of its descendants, that start in the same time
+// window [k * window, (k + 1) * window) of the detector. Descendants join the
+// hit of their parent in the window, if any, as they come. The hits are
+// sorted by (detector, entry time), with an index of the hits of each
+// detector.
+
+#ifndef LARG4_AUXDETHITAGGREGATOR_H
+#define LARG4_AUXDETHITAGGREGATOR_H
+
+#include "lardataobj/Simulation/AuxDetHit.h"
+#include "larg4/Services/TempHit.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+namespace larg4 {
+
+  /// Open addressing hash table from 64-bit keys to 32-bit indices; clear()
+  /// keeps the capacity and only resets the slots in use
+  class FlatIndexMap {
+  public:
+    static constexpr std::uint32_t npos = ~std::uint32_t(0);
+
+    FlatIndexMap() { resize(1024); }
+
+    std::uint32_t find(std::uint64_t key) const
+    {
+      for (size_t slot = hash(key) & mask_;; slot = (slot + 1) & mask_) {
+        if (keys_[slot] == key) return values_[slot];
+        if (keys_[slot] == kEmpty) return npos;
+      }
+    }
+
+    /// Adds a key that is not in the table yet
+    void insert(std::uint64_t key, std::uint32_t value)
+    {
+      if (2 * (used_.size() + 1) > keys_.size()) resize(2 * keys_.size());
+      place(key, value);
+    }
+
+    /// Adds a key, or changes its value
+    void set(std::uint64_t key, std::uint32_t value)
+    {
+      for (size_t slot = hash(key) & mask_;; slot = (slot + 1) & mask_) {
+        if (keys_[slot] == key) {
+          values_[slot] = value;
+          return;
+        }
+        if (keys_[slot] == kEmpty) break;
+      }
+      insert(key, value);
+    }
+
+    void clear()
+    {
+      for (size_t slot: used_) keys_[slot] = kEmpty;
+      used_.clear();
+    }
+
+  private:
+    static constexpr std::uint64_t kEmpty = ~std::uint64_t(0);
+
+    static size_t hash(std::uint64_t k)
+    {
+      k ^= k >> 33;
+      k *= 0xff51afd7ed558ccdULL;
+      k ^= k >> 33;
+      return k;
+    }
+
+    void place(std::uint64_t key, std::uint32_t value)
+    {
+      size_t slot = hash(key) & mask_;
+      while (keys_[slot] != kEmpty) slot = (slot + 1) & mask_;
+      keys_[slot] = key;
+      values_[slot] = value;
+      used_.push_back(slot);
+    }
+
+    void resize(size_t capacity)
+    {
+      std::vector<std::uint64_t> keys(capacity, kEmpty);
+      std::vector<std::uint32_t> values(capacity);
+      keys.swap(keys_);
+      values.swap(values_);
+      mask_ = capacity - 1;
+      std::vector<size_t> used;
+      used.swap(used_);
+      used_.reserve(capacity / 2);
+      for (size_t slot: used) place(keys[slot], values[slot]);
+    }
+
+    std::vector<std::uint64_t> keys_;
+    std::vector<std::uint32_t> values_;
+    std::vector<size_t> used_;     // slots in use
+    size_t mask_ = 0;
+  };
+
+  inline sim::AuxDetHit makeAuxDetHit(TempHit const& step)
+  {
+    return sim::AuxDetHit(step.GetID(),
+                          step.GetTrackID(),
+                          step.GetEnergyDeposited(),
+                          step.GetEntryX(),
+                          step.GetEntryY(),
+                          step.GetEntryZ(),
+                          step.GetEntryT(),
+                          step.GetExitX(),
+                          step.GetExitY(),
+                          step.GetExitZ(),
+                          step.GetExitT(),
+                          step.GetExitMomentumX(),
+                          step.GetExitMomentumY(),
+                          step.GetExitMomentumZ());
+  }
+
+  /// Sort and merge of the buffered steps of an event (sorts `steps`),
+  /// appending the hits to `hits`
+  inline void mergeSortedAuxDetSteps(TempHitCollection& steps, sim::AuxDetHitCollection& hits)
+  {
+    if (steps.empty()) return; // No hits so nothing to do
+    std::sort(steps.begin(), steps.end());
+    int geoId = -1;
+    int trackId = -1;
+    std::unordered_set<unsigned int> setofIDs;
+
+    for (auto it = steps.begin(); it != steps.end(); it++) {
+      if (it->GetID() == geoId && trackId == it->GetTrackID()) // trackid and detector didn't change
+      {
+        hits.back().SetEnergyDeposited(hits.back().GetEnergyDeposited() + it->GetEnergyDeposited());
+        if (it->GetExitT()) // change exit vector
+        {
+          hits.back().SetExitX(it->GetExitX());
+          hits.back().SetExitY(it->GetExitY());
+          hits.back().SetExitZ(it->GetExitZ());
+          hits.back().SetExitT(it->GetExitT());
+        }
+      } else if (setofIDs.find(it->GetParentID()) != setofIDs.end()) {
+        setofIDs.insert(it->GetTrackID());
+        hits.back().SetEnergyDeposited(hits.back().GetEnergyDeposited() + it->GetEnergyDeposited());
+      } else {
+        // -- new detector, or new track in the same detector
+        geoId = it->GetID();
+        trackId = it->GetTrackID();
+        setofIDs.clear();
+        setofIDs.insert(it->GetTrackID());
+        hits.push_back(makeAuxDetHit(*it));
+      }
+    }
+  }
+
+  /// Sorts time-windowed hits by (detector, entry time) and indexes them:
+  /// the hits of detectorIDs[i] are [offsets[i], offsets[i + 1])
+  inline void sortAndIndexAuxDetHits(sim::AuxDetHitCollection& hits,
+                                     std::vector<unsigned int>& detectorIDs,
+                                     std::vector<unsigned int>& offsets)
+  {
+    std::sort(hits.begin(), hits.end(), [](sim::AuxDetHit const& a, sim::AuxDetHit const& b) {
+        if (a.GetID() != b.GetID()) return a.GetID() < b.GetID();
+        if (a.GetEntryT() != b.GetEntryT()) return a.GetEntryT() < b.GetEntryT();
+        return a.GetTrackID() < b.GetTrackID();
+      });
+    detectorIDs.clear();
+    offsets.clear();
+    for (size_t i = 0; i < hits.size(); ++i) {
+      if (i == 0 || hits[i].GetID() != hits[i - 1].GetID()) {
+        detectorIDs.push_back(hits[i].GetID());
+        offsets.push_back(i);
+      }
+    }
+    offsets.push_back(hits.size());
+  }
+
+  /// Streaming merge of the steps of an event
+  class AuxDetHitAggregator {
+  public:
+    void clear()
+    {
+      index_.clear();
+      partials_.clear();
+      lastKey_ = kNoKey;
+    }
+
+    void add(TempHit const& step)
+    {
+      std::uint64_t const k = key(step.GetID(), step.GetTrackID());
+      std::uint32_t partial = (k == lastKey_) ? lastPartial_ : index_.find(k); // steps of a track come in a row
+      if (partial == FlatIndexMap::npos) {
+        partial = partials_.size();
+        partials_.push_back(step);
+        index_.insert(k, partial);
+      } else {
+        TempHit& p = partials_[partial];
+        p.SetEnergyDeposited(p.GetEnergyDeposited() + step.GetEnergyDeposited());
+        if (step.GetExitT()) {
+          p.SetExitX(step.GetExitX());
+          p.SetExitY(step.GetExitY());
+          p.SetExitZ(step.GetExitZ());
+          p.SetExitT(step.GetExitT());
+        }
+      }
+      lastKey_ = k;
+      lastPartial_ = partial;
+    }
+
+    /// Appends the hits, sorted by (copy number, track ID), to `hits`
+    void finish(sim::AuxDetHitCollection& hits)
+    {
+      mergeSortedAuxDetSteps(partials_, hits);
+      clear();
+    }
+
+    /// Number of partial hits (tracks in a detector) of the event so far
+    size_t size() const { return partials_.size(); }
+
+  private:
+    static constexpr std::uint64_t kNoKey = ~std::uint64_t(0);
+
+    static std::uint64_t key(int id, int trackID)
+    {
+      return (std::uint64_t(std::uint32_t(id)) << 32) | std::uint32_t(trackID);
+    }
+
+    FlatIndexMap index_;               // (copy number, track ID) -> partial hit
+    TempHitCollection partials_;
+    std::uint64_t lastKey_ = kNoKey;
+    std::uint32_t lastPartial_ = 0;
+  };
+
+  /// Streaming merge of the steps of an event, by time window
+  class AuxDetTimeWindowAggregator {
+  public:
+    explicit AuxDetTimeWindowAggregator(double window = 1.) : window_(window) {} // [ns]
+
+    void clear()
+    {
+      index_.clear();
+      memberships_.clear();
+      hits_.clear();
+      lastKey_ = kNoKey;
+    }
+
+    void add(TempHit const& step)
+    {
+      long const window = long(std::floor(step.GetEntryT() / window_));
+      std::uint64_t const k = key(step.GetID(), step.GetTrackID());
+      std::uint32_t const last = (k == lastKey_) ? lastMembership_ : index_.find(k);
+      std::uint32_t membership = last;
+      if (last == FlatIndexMap::npos || memberships_[last].window != window) {
+        // -- first step of this track in this window of this detector: it goes
+        //    to the hit of its parent there, if any, else it starts a hit
+        std::uint32_t hit = FlatIndexMap::npos;
+        if (step.GetParentID() > 0) {
+          std::uint32_t m = index_.find(key(step.GetID(), step.GetParentID()));
+          while (m != FlatIndexMap::npos && memberships_[m].window > window) m = memberships_[m].previous;
+          if (m != FlatIndexMap::npos && memberships_[m].window == window) hit = memberships_[m].hit;
+        }
+        membership = memberships_.size();
+        if (hit == FlatIndexMap::npos) {
+          memberships_.push_back({std::uint32_t(hits_.size()), last, window});
+          hits_.push_back(makeAuxDetHit(step));
+          index_.set(k, membership);
+          lastKey_ = k;
+          lastMembership_ = membership;
+          return;
+        }
+        memberships_.push_back({hit, last, window});
+        index_.set(k, membership);
+      }
+      lastKey_ = k;
+      lastMembership_ = membership;
+
+      sim::AuxDetHit& h = hits_[memberships_[membership].hit];
+      h.SetEnergyDeposited(h.GetEnergyDeposited() + step.GetEnergyDeposited());
+      if (int(h.GetTrackID()) == step.GetTrackID() && step.GetExitT()) {
+        h.SetExitX(step.GetExitX());
+        h.SetExitY(step.GetExitY());
+        h.SetExitZ(step.GetExitZ());
+        h.SetExitT(step.GetExitT());
+      }
+    }
+
+    /// Moves the hits, sorted by (detector, entry time), to `hits` (replacing
+    /// its content); the hits of detectorIDs[i] are [offsets[i], offsets[i + 1])
+    void finish(sim::AuxDetHitCollection& hits,
+                std::vector<unsigned int>& detectorIDs,
+                std::vector<unsigned int>& offsets)
+    {
+      sortAndIndexAuxDetHits(hits_, detectorIDs, offsets);
+      hits.swap(hits_);
+      clear();
+    }
+
+  private:
+    static constexpr std::uint64_t kNoKey = ~std::uint64_t(0);
+
+    static std::uint64_t key(int id, int trackID)
+    {
+      return (std::uint64_t(std::uint32_t(id)) << 32) | std::uint32_t(trackID);
+    }
+
+    // -- the hit that a track contributes to in one window
+    struct Membership {
+      std::uint32_t hit;
+      std::uint32_t previous;   // same track and detector, earlier window (npos: none)
+      long window;
+    };
+
+    double window_;
+    FlatIndexMap index_;                    // (detector, track ID) -> its last membership
+    std::vector<Membership> memberships_;
+    sim::AuxDetHitCollection hits_;
+    std::uint64_t lastKey_ = kNoKey;
+    std::uint32_t lastMembership_ = 0;
+  };
+
+} // namespace larg4
+
+#endif // LARG4_AUXDETHITAGGREGATOR_H
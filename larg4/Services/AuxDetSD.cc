@@ -12,9 +12,10 @@
 // AuxDetSD.cc: Class representing a sensitive aux detector
 // Author: Hans Wenzel (Fermilab)
 //=============================================================================
-#include<algorithm>
-#include<unordered_set>
+#include<utility>
 #include "larg4/Services/AuxDetSD.h"
+#include "larg4/Services/TimingRecorder.h"
+#include "cetlib_except/exception.h"
 #include "Geant4/G4HCofThisEvent.hh"
 #include "Geant4/G4Step.hh"
 #include "Geant4/G4ThreeVector.hh"
@@ -30,10 +31,31 @@
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
 namespace larg4 {
 
-  AuxDetSD::AuxDetSD(G4String name)
+  AuxDetSD::AuxDetSD(G4String name, fhicl::ParameterSet const& config)
   : G4VSensitiveDetector(name)
+  , processHitsSlot(TimingRecorder::instance().slot("SD/" + name + "/ProcessHits"))
+  , endOfEventSlot(TimingRecorder::instance().slot("SD/" + name + "/EndOfEvent"))
   {
     hitCollection.clear();
+    std::string const mode = config.get<std::string>("aggregation", "sorted");
+    if (mode == "streaming") streaming = true;
+    else if (mode != "sorted") {
+      throw cet::exception("AuxDetSD") << "Unknown aggregation mode: " << mode
+                                       << " (sorted, streaming)\n";
+    }
+    timeWindow = config.get<double>("timeWindow", 0.);
+    if (timeWindow > 0.) {
+      if (!streaming) {
+        throw cet::exception("AuxDetSD") << "timeWindow needs aggregation: \"streaming\"\n";
+      }
+      windowedAggregator = AuxDetTimeWindowAggregator(timeWindow);
+    }
+    std::string const channels = config.get<std::string>("channels", "copyNumber");
+    if (channels == "channelMap") useChannelMap = true;
+    else if (channels != "copyNumber") {
+      throw cet::exception("AuxDetSD") << "Unknown channels: " << channels
+                                       << " (copyNumber, channelMap)\n";
+    }
   }
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -44,19 +66,33 @@ AuxDetSD::~AuxDetSD() {
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
 void  AuxDetSD::Initialize(G4HCofThisEvent* ) {
    hitCollection.clear();
+   hitCollection.reserve(releasedHits);
    temphitCollection.clear();
+   aggregator.clear();
+   windowedAggregator.clear();
+   finalized = false;
+   timeSteps = TimingRecorder::instance().level() >= TimingRecorder::kStep;
 }
+  //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+  sim::AuxDetHitCollection AuxDetSD::ReleaseHits() {
+    releasedHits = hitCollection.size();
+    return std::exchange(hitCollection, {});
+  }
   //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
   G4bool  AuxDetSD::ProcessHits(G4Step* step, G4TouchableHistory*) {
+  ScopedTimer timer(timeSteps ? processHitsSlot : -1, TimingRecorder::kStep);
   G4double edep = step->GetTotalEnergyDeposit() / CLHEP::MeV;
   if (edep == 0.) return false;
   G4Track * track = step->GetTrack();
-  const unsigned int trackID = track->GetTrackID();
-  unsigned int ID = step->GetPreStepPoint()->GetPhysicalVolume()->GetCopyNo();
+  const unsigned int trackID = track->GetTrackID() + trackIDOffset;
+  // primaries keep parent ID 0
+  const int parentID = (track->GetParentID() > 0) ? track->GetParentID() + trackIDOffset : 0;
+  unsigned int ID = channelMap ? channelMap->channel(step->GetPreStepPoint()->GetTouchable())
+                               : step->GetPreStepPoint()->GetPhysicalVolume()->GetCopyNo();
   TempHit tmpHit = TempHit(
 			   ID,
 			   trackID,
-			   track->GetParentID(),
+			   parentID,
 			   step->IsFirstStepInVolume(),
 			   step->IsLastStepInVolume(),
 			   edep,
@@ -72,7 +108,9 @@ void  AuxDetSD::Initialize(G4HCofThisEvent* ) {
 			   step->GetPostStepPoint()->GetMomentum().getY() / CLHEP::GeV,
 			   step->GetPostStepPoint()->GetMomentum().getZ() / CLHEP::GeV
 			   );
-  temphitCollection.push_back(tmpHit);
+  if (timeWindow > 0.) windowedAggregator.add(tmpHit);
+  else if (streaming) aggregator.add(tmpHit);
+  else temphitCollection.push_back(tmpHit);
 
   /*
   sim::AuxDetHit newHit = sim::AuxDetHit(ID,
@@ -97,98 +135,16 @@ void  AuxDetSD::Initialize(G4HCofThisEvent* ) {
 
 
 void AuxDetSD::EndOfEvent(G4HCofThisEvent*) {
-    if (temphitCollection.size() == 0) return; // No hits so nothing to do
-#if defined _verbose_
-    std::cout << " EndOfEvent number of temp hits: " << temphitCollection.size() << std::endl;
-    std::cout << " EndOfEvent number of aux hits: " << hitCollection.size() << std::endl;
-#endif
-    std::sort(temphitCollection.begin(), temphitCollection.end());
-    int geoId = -1;
-    int trackId = -1;
-    unsigned int counter = 0;
-    std::unordered_set<unsigned int> setofIDs;
+    if (!deferFinalization) FinalizeEvent();
+}
 
-    for (auto it = temphitCollection.begin(); it != temphitCollection.end(); it++) {
-#if defined _verbose_
-        std::cout << "geoID: " << it->GetID() << " track ID: " << it->GetTrackID() << " Edep: " << it->GetEnergyDeposited()
-                << " Parent Id: " << it->GetParentID() << " exit Time:  " << it->GetExitT()
-                << " is first: " << it->IsIsfirstinVolume() << " is last:  " << it->IsIslastinVolume();
-#endif
-        if (it->GetID() == geoId && trackId == it->GetTrackID()) // trackid and detector didn't change
-        {
-#if defined _verbose_
-            std::cout << " A" << std::endl;
-#endif
-            if (it->GetExitT()) // change exit vector and add to total charge
-            {
-                hitCollection[counter - 1].SetEnergyDeposited(hitCollection[counter - 1].GetEnergyDeposited() + it->GetEnergyDeposited());
-                hitCollection[counter - 1].SetExitX(it->GetExitX());
-                hitCollection[counter - 1].SetExitY(it->GetExitY());
-                hitCollection[counter - 1].SetExitZ(it->GetExitZ());
-                hitCollection[counter - 1].SetExitT(it->GetExitT());
-            } else // just add to total charge
-            {
-                hitCollection[counter - 1].SetEnergyDeposited(hitCollection[counter - 1].GetEnergyDeposited() + it->GetEnergyDeposited());
-	    }
-        } else if (setofIDs.find(it->GetParentID()) != setofIDs.end()) {
-            setofIDs.insert(it->GetTrackID());
-#if defined _verbose_
-            std::cout << " A" << std::endl;
-#endif
-            hitCollection[counter - 1].SetEnergyDeposited(hitCollection[counter - 1].GetEnergyDeposited() + it->GetEnergyDeposited());
-        } else if (it->GetID() != geoId) // new Detector
-        {
-            geoId = it->GetID();
-            trackId = it->GetTrackID();
-            setofIDs.clear();
-            setofIDs.insert(it->GetTrackID());
-#if defined _verbose_
-            std::cout << " N" << std::endl;
-#endif
-            counter++;
-            hitCollection.push_back(sim::AuxDetHit(it->GetID(),
-                    it->GetTrackID(),
-                    it->GetEnergyDeposited(),
-                    it->GetEntryX(),
-                    it->GetEntryY(),
-                    it->GetEntryZ(),
-                    it->GetEntryT(),
-                    it->GetExitX(),
-                    it->GetExitY(),
-                    it->GetExitZ(),
-                    it->GetExitT(),
-                    it->GetExitMomentumX(),
-                    it->GetExitMomentumY(),
-                    it->GetExitMomentumZ()
-						       ));
-        } else {
-            trackId = it->GetTrackID();
-#if defined _verbose_
-            std::cout << " N" << std::endl;
-#endif
-            counter++;
-            setofIDs.clear();
-            setofIDs.insert(it->GetTrackID());
-            hitCollection.push_back(sim::AuxDetHit(it->GetID(),
-                    it->GetTrackID(),
-                    it->GetEnergyDeposited(),
-                    it->GetEntryX(),
-                    it->GetEntryY(),
-                    it->GetEntryZ(),
-                    it->GetEntryT(),
-                    it->GetExitX(),
-                    it->GetExitY(),
-                    it->GetExitZ(),
-                    it->GetExitT(),
-                    it->GetExitMomentumX(),
-                    it->GetExitMomentumY(),
-                    it->GetExitMomentumZ()
-                    ));
-        }
-    }
-#if defined _verbose_
-    std::cout << "Number of AuxDetHits: " << counter << std::endl;
-#endif
-	}  // EndOfEvent
+void AuxDetSD::FinalizeEvent() {
+    if (finalized) return;
+    finalized = true;
+    ScopedTimer timer(endOfEventSlot);
+    if (timeWindow > 0.) windowedAggregator.finish(hitCollection, detectorIDs, detectorOffsets);
+    else if (streaming) aggregator.finish(hitCollection);
+    else mergeSortedAuxDetSteps(temphitCollection, hitCollection);
+	}  // FinalizeEvent
 } // namespace sim
 
@@ -5,10 +5,17 @@
 #ifndef AuxDetSD_h
 #define AuxDetSD_h 1
 #include "lardataobj/Simulation/AuxDetHit.h"
+#include "larg4/Services/AuxDetChannelMap.h"
+#include "larg4/Services/AuxDetHitAggregator.h"
 #include "larg4/Services/TempHit.h"
 #include "larcore/Geometry/Geometry.h"
+#include "fhiclcpp/ParameterSet.h"
 #include "Geant4/G4VSensitiveDetector.hh"
 
+#include <memory>
+#include <utility>
+#include <vector>
+
 #if defined __clang__
   #pragma clang diagnostic push
   #pragma clang diagnostic ignored "-Wunused-private-field"
@@ -21,18 +28,69 @@ class AuxDetHitCollection;
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
 namespace larg4 {
 
+    // The steps are merged into one hit per detector (copy number) and track,
+    // with the energy of the descendants of the track in that detector, by
+    // `aggregation` (see AuxDetHitAggregator.h):
+    //  "sorted"    : buffered, sorted and merged at the end of the event
+    //                (default)
+    //  "streaming" : summed by track as they come, the sums merged at the end
+    //                of the event
+    // Both give the same hits up to rounding: the energies are float sums
+    // taken in a different order and can differ in the last bits, which is
+    // why "sorted", the original merge, stays the default.
+    //
+    // With `timeWindow` [ns] > 0 the hits are also split in time windows of
+    // that length (streaming only) and sorted by (detector, entry time), with
+    // an index of the hits of each detector (see AuxDetTimeWindowAggregator).
+    // When an art event is simulated in sub-events, the detector service
+    // sorts and indexes the hits of all of them again with the last one.
+    //
+    // The detector of a hit (its ID) is, by `channels`:
+    //  "copyNumber" : the copy number of the volume of the step (default)
+    //  "channelMap" : its channel in the AuxDet channel map built by the
+    //                 detector service (see AuxDetChannelMap.h)
     class AuxDetSD : public G4VSensitiveDetector {
     public:
-      AuxDetSD(G4String name );
+      AuxDetSD(G4String name, fhicl::ParameterSet const& config = fhicl::ParameterSet());
       virtual ~AuxDetSD();
       void Initialize(G4HCofThisEvent*);
       void EndOfEvent(G4HCofThisEvent*);
+      // merges the steps into hits; called by EndOfEvent unless deferred
+      // (the detector service then calls it, possibly on another thread)
+      void FinalizeEvent();
+      void SetDeferredFinalization(bool defer) { deferFinalization = defer; }
       G4bool ProcessHits(G4Step*, G4TouchableHistory*);
       const sim::AuxDetHitCollection& GetHits() const { return hitCollection; }
+      // moves the hits of the event out of the detector (GetHits() is empty afterwards)
+      sim::AuxDetHitCollection ReleaseHits();
+      // with time windows: the detectors with hits, and the offsets of their
+      // hits in the collection (one more than detectors), also moved out
+      bool TimeWindowed() const { return timeWindow > 0.; }
+      std::vector<unsigned int> ReleaseDetectorIDs() { return std::exchange(detectorIDs, {}); }
+      std::vector<unsigned int> ReleaseDetectorOffsets() { return std::exchange(detectorOffsets, {}); }
+      // offset added to the Geant4 track IDs when an art event is split into sub-events
+      void SetTrackIDOffset(int offset) { trackIDOffset = offset; }
+      bool UsesChannelMap() const { return useChannelMap; }
+      void SetChannelMap(std::shared_ptr<AuxDetChannelMap const> map) { channelMap = std::move(map); }
 
     private:
-      TempHitCollection temphitCollection;
+      int trackIDOffset = 0;
+      int processHitsSlot;   // timing of ProcessHits
+      bool timeSteps = false; // per-step timing on (the level, read once per event)
+      int endOfEventSlot;    // timing of the end-of-event merge
+      bool deferFinalization = false;
+      bool finalized = false;
+      bool streaming = false;
+      bool useChannelMap = false;
+      std::shared_ptr<AuxDetChannelMap const> channelMap;
+      double timeWindow = 0.;               // [ns], 0: no time windows
+      AuxDetHitAggregator aggregator;       // streaming
+      AuxDetTimeWindowAggregator windowedAggregator;  // streaming, by time window
+      std::vector<unsigned int> detectorIDs;
+      std::vector<unsigned int> detectorOffsets;
+      TempHitCollection temphitCollection;  // sorted
       sim::AuxDetHitCollection hitCollection;
+      size_t releasedHits = 0;  // size of the last released collection, to reserve the next one
     };
 }   // namespace larg4
 #if defined __clang__
@@ -0,0 +1,33 @@
+// ContentHash.h
+//
+// Hash used to key the on-disk caches of larg4 (physics tables, geometry
+// checks). 64-bit FNV-1a: unlike std::hash it does not depend on the
+// platform, compiler or standard library, so caches can be shared by jobs
+// built differently.
+
+#ifndef LARG4_CONTENTHASH_H
+#define LARG4_CONTENTHASH_H
+
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace larg4 {
+
+  /// Returns the 64-bit FNV-1a hash of `content` as 16 hexadecimal digits
+  inline std::string contentHash(std::string const& content)
+  {
+    std::uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c: content) {
+      h ^= c;
+      h *= 1099511628211ULL;
+    }
+    std::ostringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0') << h;
+    return out.str();
+  }
+
+} // namespace larg4
+
+#endif // LARG4_CONTENTHASH_H
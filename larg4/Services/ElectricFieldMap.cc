@@ -0,0 +1,123 @@
+//=============================================================================
+// ElectricFieldMap.cc: electric field of a volume, uniform or on a grid
+//=============================================================================
+#include "larg4/Services/ElectricFieldMap.h"
+#include "cetlib_except/exception.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+  char const kMagic[8] = {'L', 'A', 'R', 'G', '4', 'E', 'F', '1'};
+  size_t const kHeaderSize = 8 + 4 * sizeof(std::uint32_t) + 6 * sizeof(double);
+}
+
+namespace larg4 {
+
+  ElectricFieldMap::ElectricFieldMap(double field)
+    : source_("uniform")
+    , uniformField_{field, 0., 0.}
+  {}
+
+  ElectricFieldMap::ElectricFieldMap(std::string const& fileName)
+    : source_(fileName)
+  {
+    int const fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw cet::exception("ElectricFieldMap") << "Cannot open field map: " << fileName << "\n";
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < kHeaderSize) {
+      close(fd);
+      throw cet::exception("ElectricFieldMap") << "Not a field map (too short): " << fileName << "\n";
+    }
+    mappingSize_ = st.st_size;
+    mapping_ = mmap(nullptr, mappingSize_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // -- the mapping stays valid
+    if (mapping_ == MAP_FAILED) {
+      mapping_ = nullptr;
+      throw cet::exception("ElectricFieldMap") << "Cannot map field map: " << fileName << "\n";
+    }
+
+    char const* bytes = static_cast<char const*>(mapping_);
+    std::uint32_t header[4];
+    std::memcpy(header, bytes + 8, sizeof(header));
+    std::memcpy(origin_, bytes + 8 + sizeof(header), sizeof(origin_));
+    std::memcpy(spacing_, bytes + 8 + sizeof(header) + sizeof(origin_), sizeof(spacing_));
+    std::copy(header, header + 3, n_);
+    size_t const nodes = size_t(n_[0]) * n_[1] * n_[2];
+    bool const valid = std::memcmp(bytes, kMagic, sizeof(kMagic)) == 0
+      && n_[0] >= 2 && n_[1] >= 2 && n_[2] >= 2
+      && spacing_[0] > 0. && spacing_[1] > 0. && spacing_[2] > 0.
+      && mappingSize_ == kHeaderSize + 3 * nodes * sizeof(float);
+    if (!valid) {
+      munmap(mapping_, mappingSize_);
+      mapping_ = nullptr;
+      throw cet::exception("ElectricFieldMap") << "Invalid field map: " << fileName
+                                               << " (bad header or size)\n";
+    }
+    data_ = reinterpret_cast<float const*>(bytes + kHeaderSize);
+    // -- lookups follow the tracks: no read-ahead of the whole file
+    madvise(mapping_, mappingSize_, MADV_RANDOM);
+  }
+
+  ElectricFieldMap::~ElectricFieldMap()
+  {
+    if (mapping_) munmap(mapping_, mappingSize_);
+  }
+
+  ElectricFieldMap::Field ElectricFieldMap::at(double x, double y, double z) const
+  {
+    if (!data_) return uniformField_;
+
+    // -- cell of the position and fractional position in the cell
+    double const p[3] = {x, y, z};
+    size_t cell[3];
+    double f[3];
+    for (int a = 0; a < 3; ++a) {
+      // -- std::clamp passes a NaN through, and size_t(NaN) is undefined
+      if (!std::isfinite(p[a])) return Field{0., 0., 0.};
+      double const u = std::clamp((p[a] - origin_[a]) / spacing_[a], 0., double(n_[a] - 1));
+      cell[a] = std::min(size_t(u), size_t(n_[a] - 2));
+      f[a] = u - cell[a];
+    }
+    size_t const sx = 3;
+    size_t const sy = 3 * size_t(n_[0]);
+    size_t const sz = sy * n_[1];
+    float const* c = data_ + cell[0] * sx + cell[1] * sy + cell[2] * sz;
+
+    Field field{0., 0., 0.};
+    for (int dz = 0; dz < 2; ++dz) {
+      double const wz = dz ? f[2] : 1. - f[2];
+      for (int dy = 0; dy < 2; ++dy) {
+        double const wyz = wz * (dy ? f[1] : 1. - f[1]);
+        float const* v = c + dy * sy + dz * sz;
+        double const w0 = wyz * (1. - f[0]);
+        double const w1 = wyz * f[0];
+        field.x += w0 * v[0] + w1 * v[3];
+        field.y += w0 * v[1] + w1 * v[4];
+        field.z += w0 * v[2] + w1 * v[5];
+      }
+    }
+    return field;
+  }
+
+  void ElectricFieldMap::magnitudes(size_t n, double const* x, double const* y, double const* z,
+                                    double* out) const
+  {
+    if (!data_) {
+      std::fill(out, out + n, std::abs(uniformField_.x));
+      return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      Field const f = at(x[i], y[i], z[i]);
+      out[i] = std::sqrt(f.x * f.x + f.y * f.y + f.z * f.z);
+    }
+  }
+
+} // namespace larg4
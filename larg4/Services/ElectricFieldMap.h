@@ -0,0 +1,67 @@
+// ElectricFieldMap.h
+//
+// Electric field of a volume: uniform, or a 3D grid read from a file (e.g. a
+// field distorted by space charge), interpolated trilinearly.
+//
+// The grid file is memory-mapped read-only: it is not read at startup, only
+// the pages that are looked up are loaded, and they are shared by all the
+// jobs running on the machine. Format (little endian):
+//
+//   char     magic[8]       "LARG4EF1"
+//   uint32   nx, ny, nz     number of nodes along each axis (>= 2)
+//   uint32   reserved       0
+//   double   origin[3]      position of node (0,0,0) [cm], global frame
+//   double   spacing[3]     distance between nodes along x, y, z [cm]
+//   float    field[nz][ny][nx][3]   Ex, Ey, Ez at each node [kV/cm]
+//
+// The three components of a node are contiguous and x runs fastest, so the
+// eight nodes of a cell lie on four pairs of neighbouring vectors. Positions
+// outside the grid take the field of the nearest point on its boundary;
+// non-finite positions (NaN, infinities) have no field.
+
+#ifndef LARG4_ELECTRICFIELDMAP_H
+#define LARG4_ELECTRICFIELDMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace larg4 {
+
+  class ElectricFieldMap {
+  public:
+    struct Field {
+      double x, y, z;   // [kV/cm]
+    };
+
+    /// Uniform field of this magnitude [kV/cm], along x
+    explicit ElectricFieldMap(double field);
+    /// Grid read from a file (see the format above)
+    explicit ElectricFieldMap(std::string const& fileName);
+    ~ElectricFieldMap();
+    ElectricFieldMap(ElectricFieldMap const&) = delete;
+    ElectricFieldMap& operator=(ElectricFieldMap const&) = delete;
+
+    /// Field at a position [cm]
+    Field at(double x, double y, double z) const;
+
+    /// Magnitudes [kV/cm] of the field at n positions [cm]
+    void magnitudes(size_t n, double const* x, double const* y, double const* z, double* out) const;
+
+    bool uniform() const { return !data_; }
+    std::string const& source() const { return source_; }
+
+  private:
+    std::string source_;              // file name, or "uniform"
+    Field uniformField_{0., 0., 0.};
+    void* mapping_ = nullptr;         // the whole file
+    size_t mappingSize_ = 0;
+    float const* data_ = nullptr;     // the nodes, in the mapping
+    std::uint32_t n_[3] = {0, 0, 0};
+    double origin_[3] = {0., 0., 0.};
+    double spacing_[3] = {1., 1., 1.};
+  };
+
+} // namespace larg4
+
+#endif // LARG4_ELECTRICFIELDMAP_H
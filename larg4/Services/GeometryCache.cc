@@ -0,0 +1,792 @@
+//=============================================================================
+// GeometryCache.cc: binary cache of a geometry read from GDML
+//=============================================================================
+#include "larg4/Services/GeometryCache.h"
+#include "larg4/Services/ContentHash.h"
+#include "cetlib_except/exception.h"
+
+#include "Geant4/G4AffineTransform.hh"
+#include "Geant4/G4Box.hh"
+#include "Geant4/G4Colour.hh"
+#include "Geant4/G4Cons.hh"
+#include "Geant4/G4DisplacedSolid.hh"
+#include "Geant4/G4Element.hh"
+#include "Geant4/G4IntersectionSolid.hh"
+#include "Geant4/G4Isotope.hh"
+#include "Geant4/G4LogicalBorderSurface.hh"
+#include "Geant4/G4LogicalSkinSurface.hh"
+#include "Geant4/G4LogicalVolume.hh"
+#include "Geant4/G4LogicalVolumeStore.hh"
+#include "Geant4/G4Material.hh"
+#include "Geant4/G4MaterialPropertiesTable.hh"
+#include "Geant4/G4NistManager.hh"
+#include "Geant4/G4OpticalSurface.hh"
+#include "Geant4/G4PhysicalVolumeStore.hh"
+#include "Geant4/G4Polycone.hh"
+#include "Geant4/G4PVPlacement.hh"
+#include "Geant4/G4Sphere.hh"
+#include "Geant4/G4SubtractionSolid.hh"
+#include "Geant4/G4Torus.hh"
+#include "Geant4/G4Trd.hh"
+#include "Geant4/G4Tubs.hh"
+#include "Geant4/G4UnionSolid.hh"
+#include "Geant4/G4Version.hh"
+#include "Geant4/G4VisAttributes.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+  char const kMagic[8] = {'L', 'A', 'R', 'G', '4', 'G', 'E', 'O'};
+  std::uint32_t const kFormatVersion = 2;
+  size_t const kTrailerSize = 16; // contentHash of everything before it
+
+  enum ElementType : std::uint8_t { kNistElement, kNaturalElement, kIsotopeElement };
+  enum MaterialType : std::uint8_t { kNistMaterial, kByMassFraction, kByAtomCount };
+
+  enum SolidType : std::uint8_t {
+    kBox, kTubs, kCons, kTrd, kSphere, kTorus, kPolycone,
+    kUnion, kSubtraction, kIntersection, kDisplaced
+  };
+
+  // -- the geometry cannot be cached
+  struct Unsupported {
+    std::string why;
+  };
+
+  class Writer {
+  public:
+    template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+    void put(T value) { data_.append(reinterpret_cast<char const*>(&value), sizeof(value)); }
+    void put(std::string const& s)
+    {
+      put<std::uint32_t>(s.size());
+      data_.append(s);
+    }
+    void append(Writer const& other) { data_.append(other.data_); }
+    std::string const& data() const { return data_; }
+
+  private:
+    std::string data_;
+  };
+
+  class Reader {
+  public:
+    Reader(std::string const& data, size_t end) : data_(data), end_(end) {}
+    template <typename T>
+    T get()
+    {
+      need(sizeof(T));
+      T value;
+      std::memcpy(&value, data_.data() + pos_, sizeof(T));
+      pos_ += sizeof(T);
+      return value;
+    }
+    std::string getString()
+    {
+      auto const n = get<std::uint32_t>();
+      need(n);
+      std::string s = data_.substr(pos_, n);
+      pos_ += n;
+      return s;
+    }
+    std::vector<double> getDoubles(size_t n)
+    {
+      std::vector<double> values(n);
+      for (auto& value: values) value = get<double>();
+      return values;
+    }
+    bool atEnd() const { return pos_ == end_; }
+
+  private:
+    void need(size_t n) const
+    {
+      if (pos_ + n > end_) throw cet::exception("GeometryCache") << "Truncated geometry cache\n";
+    }
+    std::string const& data_;
+    size_t end_;
+    size_t pos_ = 0;
+  };
+
+  // -- the border and skin surface tables are vectors or maps depending on
+  //    the Geant4 version
+  template <typename S> S const* surfaceOf(S const* s) { return s; }
+  template <typename K, typename S> S const* surfaceOf(std::pair<K const, S*> const& e) { return e.second; }
+
+  template <typename T>
+  std::map<T const*, std::uint32_t> indexOf(std::vector<T*> const& objects)
+  {
+    std::map<T const*, std::uint32_t> index;
+    for (auto const* object: objects) index.emplace(object, index.size());
+    return index;
+  }
+
+  template <typename T>
+  std::uint32_t lookup(std::map<T const*, std::uint32_t> const& index, T const* object, char const* what)
+  {
+    auto const it = index.find(object);
+    if (it == index.end()) throw Unsupported{std::string(what) + " outside of the Geant4 stores"};
+    return it->second;
+  }
+
+  void putProperties(Writer& out, G4MaterialPropertiesTable const* table)
+  {
+    out.put<std::uint8_t>(table != nullptr);
+    if (!table) return;
+    std::vector<G4String> const names = table->GetMaterialPropertyNames();
+    out.put<std::uint32_t>(table->GetPropertyMap()->size());
+    for (auto const& [index, vector]: *table->GetPropertyMap()) {
+      out.put(names.at(index));
+      size_t const n = vector->GetVectorLength();
+      out.put<std::uint32_t>(n);
+      for (size_t i = 0; i < n; ++i) {
+        out.put<double>(vector->Energy(i));
+        out.put<double>((*vector)[i]);
+      }
+    }
+    std::vector<G4String> const constNames = table->GetMaterialConstPropertyNames();
+    out.put<std::uint32_t>(table->GetConstPropertyMap()->size());
+    for (auto const& [index, value]: *table->GetConstPropertyMap()) {
+      out.put(constNames.at(index));
+      out.put<double>(value);
+    }
+  }
+
+  G4MaterialPropertiesTable* getProperties(Reader& in)
+  {
+    if (!in.get<std::uint8_t>()) return nullptr;
+    auto table = new G4MaterialPropertiesTable;
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+      std::string const name = in.getString();
+      auto const entries = in.get<std::uint32_t>();
+      std::vector<double> energies(entries), values(entries);
+      for (size_t i = 0; i < entries; ++i) {
+        energies[i] = in.get<double>();
+        values[i] = in.get<double>();
+      }
+      table->AddProperty(name.c_str(), energies.data(), values.data(), entries);
+    }
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+      std::string const name = in.getString();
+      table->AddConstProperty(name.c_str(), in.get<double>());
+    }
+    return table;
+  }
+
+  void putTransform(Writer& out, G4AffineTransform const& t)
+  {
+    // -- rotation rows and translation, as in the 12-value constructor
+    for (int i: {0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14}) out.put<double>(t[i]);
+  }
+
+  G4AffineTransform getTransform(Reader& in)
+  {
+    auto const v = in.getDoubles(12);
+    return G4AffineTransform(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10], v[11]);
+  }
+
+  // -- solids are written after the solids they are made of
+  class SolidWriter {
+  public:
+    explicit SolidWriter(Writer& out) : out_(out) {}
+
+    std::uint32_t index(G4VSolid const* solid)
+    {
+      auto const it = index_.find(solid);
+      if (it != index_.end()) return it->second;
+
+      std::string const type = solid->GetEntityType();
+      Writer record;
+      if (type == "G4Box") {
+        auto s = static_cast<G4Box const*>(solid);
+        record.put<std::uint8_t>(kBox);
+        for (double v: {s->GetXHalfLength(), s->GetYHalfLength(), s->GetZHalfLength()}) record.put(v);
+      }
+      else if (type == "G4Tubs") {
+        auto s = static_cast<G4Tubs const*>(solid);
+        record.put<std::uint8_t>(kTubs);
+        for (double v: {s->GetInnerRadius(), s->GetOuterRadius(), s->GetZHalfLength(),
+                        s->GetStartPhiAngle(), s->GetDeltaPhiAngle()}) record.put(v);
+      }
+      else if (type == "G4Cons") {
+        auto s = static_cast<G4Cons const*>(solid);
+        record.put<std::uint8_t>(kCons);
+        for (double v: {s->GetInnerRadiusMinusZ(), s->GetOuterRadiusMinusZ(),
+                        s->GetInnerRadiusPlusZ(), s->GetOuterRadiusPlusZ(),
+                        s->GetZHalfLength(), s->GetStartPhiAngle(), s->GetDeltaPhiAngle()}) record.put(v);
+      }
+      else if (type == "G4Trd") {
+        auto s = static_cast<G4Trd const*>(solid);
+        record.put<std::uint8_t>(kTrd);
+        for (double v: {s->GetXHalfLength1(), s->GetXHalfLength2(), s->GetYHalfLength1(),
+                        s->GetYHalfLength2(), s->GetZHalfLength()}) record.put(v);
+      }
+      else if (type == "G4Sphere") {
+        auto s = static_cast<G4Sphere const*>(solid);
+        record.put<std::uint8_t>(kSphere);
+        for (double v: {s->GetInnerRadius(), s->GetOuterRadius(), s->GetStartPhiAngle(),
+                        s->GetDeltaPhiAngle(), s->GetStartThetaAngle(), s->GetDeltaThetaAngle()}) record.put(v);
+      }
+      else if (type == "G4Torus") {
+        auto s = static_cast<G4Torus const*>(solid);
+        record.put<std::uint8_t>(kTorus);
+        for (double v: {s->GetRmin(), s->GetRmax(), s->GetRtor(), s->GetSPhi(), s->GetDPhi()}) record.put(v);
+      }
+      else if (type == "G4Polycone") {
+        G4PolyconeHistorical const* p = static_cast<G4Polycone const*>(solid)->GetOriginalParameters();
+        record.put<std::uint8_t>(kPolycone);
+        record.put<double>(p->Start_angle);
+        record.put<double>(p->Opening_angle);
+        record.put<std::uint32_t>(p->Num_z_planes);
+        for (int i = 0; i < p->Num_z_planes; ++i) {
+          record.put<double>(p->Z_values[i]);
+          record.put<double>(p->Rmin[i]);
+          record.put<double>(p->Rmax[i]);
+        }
+      }
+      else if (type == "G4UnionSolid" || type == "G4SubtractionSolid" || type == "G4IntersectionSolid") {
+        std::uint32_t const a = index(solid->GetConstituentSolid(0));
+        std::uint32_t const b = index(solid->GetConstituentSolid(1));
+        record.put<std::uint8_t>(type == "G4UnionSolid" ? kUnion :
+                                 type == "G4SubtractionSolid" ? kSubtraction : kIntersection);
+        record.put(a);
+        record.put(b);
+      }
+      else if (type == "G4DisplacedSolid") {
+        auto s = static_cast<G4DisplacedSolid const*>(solid);
+        std::uint32_t const moved = index(s->GetConstituentMovedSolid());
+        record.put<std::uint8_t>(kDisplaced);
+        record.put(moved);
+        putTransform(record, s->GetDirectTransform());
+      }
+      else {
+        throw Unsupported{"solid " + solid->GetName() + " of type " + type};
+      }
+
+      out_.put(solid->GetName());
+      out_.append(record);
+      index_.emplace(solid, count_);
+      return count_++;
+    }
+
+    std::uint32_t count() const { return count_; }
+
+  private:
+    Writer& out_;
+    std::map<G4VSolid const*, std::uint32_t> index_;
+    std::uint32_t count_ = 0;
+  };
+
+  void appendGDMLContent(std::string const& path, std::string& content, int depth)
+  {
+    std::ifstream in(path);
+    if (!in) {
+      throw cet::exception("GeometryCache") << "Cannot read file: " << path << "\n";
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string const text = ss.str();
+    content += text;
+    if (depth > 16) return; // -- inclusion loop; the parser will complain
+
+    std::string const dir = path.substr(0, path.rfind('/') + 1);
+    static std::regex const includeRE
+      { R"re(<!ENTITY\s+\w+\s+SYSTEM\s+"([^"]+)"|<file\s+name\s*=\s*"([^"]+)")re" };
+    for (std::sregex_iterator it(text.begin(), text.end(), includeRE), end; it != end; ++it) {
+      std::string const included = (*it)[1].matched ? (*it)[1].str() : (*it)[2].str();
+      content += '\n' + included + '\n';
+      appendGDMLContent((included[0] == '/') ? included : dir + included, content, depth + 1);
+    }
+  }
+
+} // namespace
+
+namespace larg4 {
+
+  std::string gdmlContent(std::string const& path)
+  {
+    std::string content;
+    appendGDMLContent(path, content, 0);
+    return content;
+  }
+
+  std::string writeGeometryCache(std::string const& file, std::string const& key,
+                                 G4VPhysicalVolume const* world, G4GDMLAuxMapType const& auxMap)
+  {
+    Writer out;
+    try {
+      std::vector<G4LogicalVolume*> const& lvs = *G4LogicalVolumeStore::GetInstance();
+      std::vector<G4VPhysicalVolume*> const& pvs = *G4PhysicalVolumeStore::GetInstance();
+      auto const lvIndex = indexOf(lvs);
+      auto const pvIndex = indexOf(pvs);
+
+      // -- all the materials and elements (the physics tables are built for
+      //    the whole material table), and the isotopes of the elements; the
+      //    elements with natural abundances are rebuilt from Z and A. The
+      //    NIST elements and materials (the G4_... references of GDML) are
+      //    rebuilt by G4NistManager, as the GDML reader builds them, so that
+      //    later NIST lookups (G4_AIR...) find them instead of building copies
+      G4NistManager const* nist = G4NistManager::Instance();
+      auto const isNistElement = [nist](G4Element const* element) {
+        return nist->FindElement(G4lrint(element->GetZ())) == element;
+      };
+      auto const isNistMaterial = [nist](G4Material const* material) {
+        return material->GetName().compare(0, 3, "G4_") == 0 && nist->FindMaterial(material->GetName()) == material;
+      };
+      std::vector<G4Element*> const& elements = *G4Element::GetElementTable();
+      std::vector<G4Material*> const& materials = *G4Material::GetMaterialTable();
+      std::vector<G4Isotope*> isotopes;
+      for (G4Element const* element: elements) {
+        if (element->GetNaturalAbundanceFlag()) continue;
+        for (size_t j = 0; j < element->GetNumberOfIsotopes(); ++j) {
+          G4Isotope* isotope = const_cast<G4Isotope*>(element->GetIsotope(j));
+          if (std::find(isotopes.begin(), isotopes.end(), isotope) == isotopes.end()) isotopes.push_back(isotope);
+        }
+      }
+      for (G4Material const* material: materials) {
+        if (material->GetBaseMaterial()) throw Unsupported{"material " + material->GetName() + " has a base material"};
+        // -- a material made from Z and A has a molecule mass of its own,
+        //    which neither its mass fraction nor an atom count gives back
+        if (!isNistMaterial(material) && material->GetMassOfMolecule() != 0. && !material->GetAtomsVector()) {
+          throw Unsupported{"material " + material->GetName() + " is made from Z and A"};
+        }
+      }
+      auto const isotopeIndex = indexOf(isotopes);
+      auto const elementIndex = indexOf(elements);
+      auto const materialIndex = indexOf(materials);
+
+      out.put<std::uint32_t>(isotopes.size());
+      for (G4Isotope const* isotope: isotopes) {
+        out.put(isotope->GetName());
+        out.put<std::int32_t>(isotope->GetZ());
+        out.put<std::int32_t>(isotope->GetN());
+        out.put<double>(isotope->GetA());
+      }
+
+      out.put<std::uint32_t>(elements.size());
+      for (G4Element const* element: elements) {
+        out.put(element->GetName());
+        if (isNistElement(element)) {
+          out.put<std::uint8_t>(kNistElement);
+          out.put<std::int32_t>(G4lrint(element->GetZ()));
+          continue;
+        }
+        bool const natural = element->GetNaturalAbundanceFlag();
+        out.put<std::uint8_t>(natural ? kNaturalElement : kIsotopeElement);
+        out.put(element->GetSymbol());
+        if (natural) {
+          out.put<double>(element->GetZ());
+          out.put<double>(element->GetA());
+          continue;
+        }
+        G4double const* abundances = element->GetRelativeAbundanceVector();
+        out.put<std::uint32_t>(element->GetNumberOfIsotopes());
+        for (size_t j = 0; j < element->GetNumberOfIsotopes(); ++j) {
+          out.put(lookup(isotopeIndex, element->GetIsotope(j), "isotope"));
+          out.put<double>(abundances[j]);
+        }
+      }
+
+      out.put<std::uint32_t>(materials.size());
+      for (G4Material const* material: materials) {
+        out.put(material->GetName());
+        if (isNistMaterial(material)) {
+          out.put<std::uint8_t>(kNistMaterial);
+        }
+        else {
+          // -- the components of materials made of materials (GDML
+          //    fractions of a ref) are not kept: the elements and their
+          //    fractions, all the physics uses, are the same
+          G4int const* atoms = material->GetAtomsVector();
+          out.put<std::uint8_t>(atoms ? kByAtomCount : kByMassFraction);
+          out.put(material->GetChemicalFormula());
+          out.put<double>(material->GetDensity());
+          out.put<std::int32_t>(material->GetState());
+          out.put<double>(material->GetTemperature());
+          out.put<double>(material->GetPressure());
+          G4double const* fractions = material->GetFractionVector();
+          out.put<std::uint32_t>(material->GetNumberOfElements());
+          for (size_t i = 0; i < material->GetNumberOfElements(); ++i) {
+            out.put(lookup(elementIndex, material->GetElement(i), "element"));
+            if (atoms) out.put<std::int32_t>(atoms[i]);
+            else out.put<double>(fractions[i]);
+          }
+        }
+        out.put<double>(material->GetIonisation()->GetMeanExcitationEnergy());
+        putProperties(out, material->GetMaterialPropertiesTable());
+      }
+
+      // -- solids, as a section of their own: their count comes first
+      Writer solids;
+      SolidWriter solidWriter(solids);
+      std::vector<std::uint32_t> lvSolids;
+      for (G4LogicalVolume const* lv: lvs) lvSolids.push_back(solidWriter.index(lv->GetSolid()));
+      out.put<std::uint32_t>(solidWriter.count());
+      out.append(solids);
+
+      out.put<std::uint32_t>(lvs.size());
+      for (size_t i = 0; i < lvs.size(); ++i) {
+        G4LogicalVolume const* lv = lvs[i];
+        out.put(lv->GetName());
+        out.put(lvSolids[i]);
+        out.put(lookup(materialIndex, lv->GetMaterial(), "material"));
+        G4VisAttributes const* vis = lv->GetVisAttributes();
+        out.put<std::uint8_t>(vis != nullptr);
+        if (vis) {
+          G4Colour const& colour = vis->GetColour();
+          for (double v: {colour.GetRed(), colour.GetGreen(), colour.GetBlue(), colour.GetAlpha()}) out.put(v);
+          out.put<std::uint8_t>(vis->IsVisible());
+        }
+      }
+
+      out.put<std::uint32_t>(pvs.size());
+      for (G4VPhysicalVolume const* pv: pvs) {
+        if (!dynamic_cast<G4PVPlacement const*>(pv) || pv->IsReplicated()) {
+          throw Unsupported{"volume " + pv->GetName() + " is not a simple placement"};
+        }
+        if (!pv->GetMotherLogical() && pv != world) {
+          throw Unsupported{"volume " + pv->GetName() + " is placed nowhere"};
+        }
+        out.put(pv->GetName());
+        out.put(lookup(lvIndex, pv->GetLogicalVolume(), "logical volume"));
+        out.put<std::int64_t>(pv->GetMotherLogical() ?
+                              std::int64_t(lookup(lvIndex, pv->GetMotherLogical(), "logical volume")) : -1);
+        out.put<std::int32_t>(pv->GetCopyNo());
+        out.put<std::uint8_t>(pv->IsMany());
+        G4RotationMatrix const* rotation = pv->GetRotation();
+        out.put<std::uint8_t>(rotation != nullptr);
+        if (rotation) {
+          for (double v: {rotation->xx(), rotation->xy(), rotation->xz(),
+                          rotation->yx(), rotation->yy(), rotation->yz(),
+                          rotation->zx(), rotation->zy(), rotation->zz()}) out.put(v);
+        }
+        G4ThreeVector const translation = pv->GetTranslation();
+        for (double v: {translation.x(), translation.y(), translation.z()}) out.put(v);
+      }
+
+      // -- optical surfaces, and where they are
+      std::vector<G4OpticalSurface const*> surfaces;
+      auto surfaceIndex = [&surfaces](G4SurfaceProperty const* property, G4String const& where) {
+        auto const surface = dynamic_cast<G4OpticalSurface const*>(property);
+        if (!surface) throw Unsupported{"surface " + where + " is not an optical surface"};
+        auto const it = std::find(surfaces.begin(), surfaces.end(), surface);
+        if (it != surfaces.end()) return std::uint32_t(it - surfaces.begin());
+        surfaces.push_back(surface);
+        return std::uint32_t(surfaces.size() - 1);
+      };
+      Writer placedSurfaces;
+      G4LogicalBorderSurfaceTable const* borders = G4LogicalBorderSurface::GetSurfaceTable();
+      placedSurfaces.put<std::uint32_t>(borders ? borders->size() : 0);
+      if (borders) {
+        for (auto const& entry: *borders) {
+          G4LogicalBorderSurface const* border = surfaceOf(entry);
+          placedSurfaces.put(border->GetName());
+          placedSurfaces.put(lookup(pvIndex, border->GetVolume1(), "physical volume"));
+          placedSurfaces.put(lookup(pvIndex, border->GetVolume2(), "physical volume"));
+          placedSurfaces.put(surfaceIndex(border->GetSurfaceProperty(), border->GetName()));
+        }
+      }
+      G4LogicalSkinSurfaceTable const* skins = G4LogicalSkinSurface::GetSurfaceTable();
+      placedSurfaces.put<std::uint32_t>(skins ? skins->size() : 0);
+      if (skins) {
+        for (auto const& entry: *skins) {
+          G4LogicalSkinSurface const* skin = surfaceOf(entry);
+          placedSurfaces.put(skin->GetName());
+          placedSurfaces.put(lookup(lvIndex, skin->GetLogicalVolume(), "logical volume"));
+          placedSurfaces.put(surfaceIndex(skin->GetSurfaceProperty(), skin->GetName()));
+        }
+      }
+      out.put<std::uint32_t>(surfaces.size());
+      for (G4OpticalSurface const* surface: surfaces) {
+        out.put(surface->GetName());
+        out.put<std::int32_t>(surface->GetModel());
+        out.put<std::int32_t>(surface->GetFinish());
+        out.put<std::int32_t>(surface->GetType());
+        out.put<double>(surface->GetPolish());
+        out.put<double>(surface->GetSigmaAlpha());
+        putProperties(out, surface->GetMaterialPropertiesTable());
+      }
+      out.append(placedSurfaces);
+
+      out.put<std::uint32_t>(auxMap.size());
+      for (auto const& [lv, auxList]: auxMap) {
+        out.put(lookup(lvIndex, lv, "logical volume"));
+        out.put<std::uint32_t>(auxList.size());
+        for (auto const& aux: auxList) {
+          out.put(aux.type);
+          out.put(aux.value);
+          out.put(aux.unit);
+        }
+      }
+    }
+    catch (Unsupported const& e) {
+      return e.why;
+    }
+
+    Writer header;
+    for (char c: kMagic) header.put<char>(c);
+    header.put(kFormatVersion);
+    header.put<std::int32_t>(G4VERSION_NUMBER);
+    header.put(key);
+    header.append(out);
+    std::string content = header.data();
+    content += contentHash(content);
+
+    // -- written aside and renamed, so that concurrent jobs never read a
+    //    partial file; any file already there has the same content
+    std::string const tmpFile = file + ".tmp" + std::to_string(getpid());
+    std::ofstream stream(tmpFile, std::ios::binary);
+    stream.write(content.data(), content.size());
+    stream.close();
+    if (!stream || std::rename(tmpFile.c_str(), file.c_str()) != 0) {
+      std::remove(tmpFile.c_str());
+      return "cannot write " + file;
+    }
+    return "";
+  }
+
+  G4VPhysicalVolume* readGeometryCache(std::string const& file, std::string const& key,
+                                       G4GDMLAuxMapType& auxMap)
+  {
+    std::ifstream stream(file, std::ios::binary);
+    if (!stream) return nullptr;
+    std::ostringstream ss;
+    ss << stream.rdbuf();
+    std::string const data = ss.str();
+
+    // -- check everything before building anything
+    if (data.size() < sizeof(kMagic) + kTrailerSize
+        || contentHash(data.substr(0, data.size() - kTrailerSize)) != data.substr(data.size() - kTrailerSize)) {
+      return nullptr;
+    }
+    Reader in(data, data.size() - kTrailerSize);
+    for (char c: kMagic) {
+      if (in.get<char>() != c) return nullptr;
+    }
+    if (in.get<std::uint32_t>() != kFormatVersion
+        || in.get<std::int32_t>() != G4VERSION_NUMBER
+        || in.getString() != key) {
+      return nullptr;
+    }
+
+    std::vector<G4Isotope*> isotopes(in.get<std::uint32_t>());
+    for (auto& isotope: isotopes) {
+      std::string const name = in.getString();
+      auto const z = in.get<std::int32_t>();
+      auto const n = in.get<std::int32_t>();
+      isotope = new G4Isotope(name, z, n, in.get<double>());
+    }
+
+    std::vector<G4Element*> elements(in.get<std::uint32_t>());
+    for (auto& element: elements) {
+      std::string const name = in.getString();
+      auto const type = in.get<std::uint8_t>();
+      if (type == kNistElement) {
+        element = G4NistManager::Instance()->FindOrBuildElement(in.get<std::int32_t>());
+        if (!element || element->GetName() != name) {
+          throw cet::exception("GeometryCache") << "NIST element " << name << " not found for " << file << "\n";
+        }
+        continue;
+      }
+      std::string const symbol = in.getString();
+      if (type == kNaturalElement) {
+        double const z = in.get<double>();
+        element = new G4Element(name, symbol, z, in.get<double>());
+        continue;
+      }
+      auto const n = in.get<std::uint32_t>();
+      element = new G4Element(name, symbol, n);
+      for (size_t j = 0; j < n; ++j) {
+        G4Isotope* isotope = isotopes.at(in.get<std::uint32_t>());
+        element->AddIsotope(isotope, in.get<double>());
+      }
+    }
+
+    std::vector<G4Material*> materials(in.get<std::uint32_t>());
+    for (auto& material: materials) {
+      std::string const name = in.getString();
+      auto const type = in.get<std::uint8_t>();
+      if (type == kNistMaterial) {
+        material = G4NistManager::Instance()->FindOrBuildMaterial(name);
+        if (!material) {
+          throw cet::exception("GeometryCache") << "NIST material " << name << " not found for " << file << "\n";
+        }
+      }
+      else {
+        std::string const formula = in.getString();
+        double const density = in.get<double>();
+        auto const state = static_cast<G4State>(in.get<std::int32_t>());
+        double const temperature = in.get<double>();
+        double const pressure = in.get<double>();
+        auto const n = in.get<std::uint32_t>();
+        material = new G4Material(name, density, n, state, temperature, pressure);
+        for (size_t i = 0; i < n; ++i) {
+          G4Element* element = elements.at(in.get<std::uint32_t>());
+          if (type == kByAtomCount) material->AddElement(element, G4int(in.get<std::int32_t>()));
+          else material->AddElement(element, in.get<double>());
+        }
+        if (!formula.empty()) material->SetChemicalFormula(formula);
+      }
+      double const meanExcitationEnergy = in.get<double>();
+      if (material->GetIonisation()->GetMeanExcitationEnergy() != meanExcitationEnergy) {
+        material->GetIonisation()->SetMeanExcitationEnergy(meanExcitationEnergy);
+      }
+      if (auto table = getProperties(in)) material->SetMaterialPropertiesTable(table);
+    }
+
+    std::vector<G4VSolid*> solids(in.get<std::uint32_t>());
+    for (auto& solid: solids) {
+      std::string const name = in.getString();
+      auto const type = in.get<std::uint8_t>();
+      switch (type) {
+      case kBox: {
+        auto const v = in.getDoubles(3);
+        solid = new G4Box(name, v[0], v[1], v[2]);
+        break;
+      }
+      case kTubs: {
+        auto const v = in.getDoubles(5);
+        solid = new G4Tubs(name, v[0], v[1], v[2], v[3], v[4]);
+        break;
+      }
+      case kCons: {
+        auto const v = in.getDoubles(7);
+        solid = new G4Cons(name, v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
+        break;
+      }
+      case kTrd: {
+        auto const v = in.getDoubles(5);
+        solid = new G4Trd(name, v[0], v[1], v[2], v[3], v[4]);
+        break;
+      }
+      case kSphere: {
+        auto const v = in.getDoubles(6);
+        solid = new G4Sphere(name, v[0], v[1], v[2], v[3], v[4], v[5]);
+        break;
+      }
+      case kTorus: {
+        auto const v = in.getDoubles(5);
+        solid = new G4Torus(name, v[0], v[1], v[2], v[3], v[4]);
+        break;
+      }
+      case kPolycone: {
+        double const startPhi = in.get<double>();
+        double const deltaPhi = in.get<double>();
+        auto const n = in.get<std::uint32_t>();
+        std::vector<double> z(n), rmin(n), rmax(n);
+        for (size_t i = 0; i < n; ++i) {
+          z[i] = in.get<double>();
+          rmin[i] = in.get<double>();
+          rmax[i] = in.get<double>();
+        }
+        solid = new G4Polycone(name, startPhi, deltaPhi, n, z.data(), rmin.data(), rmax.data());
+        break;
+      }
+      case kUnion:
+      case kSubtraction:
+      case kIntersection: {
+        G4VSolid* a = solids.at(in.get<std::uint32_t>());
+        G4VSolid* b = solids.at(in.get<std::uint32_t>());
+        if (type == kUnion) solid = new G4UnionSolid(name, a, b);
+        else if (type == kSubtraction) solid = new G4SubtractionSolid(name, a, b);
+        else solid = new G4IntersectionSolid(name, a, b);
+        break;
+      }
+      case kDisplaced: {
+        G4VSolid* moved = solids.at(in.get<std::uint32_t>());
+        solid = new G4DisplacedSolid(name, moved, getTransform(in));
+        break;
+      }
+      default:
+        throw cet::exception("GeometryCache") << "Unknown solid type " << int(type) << " in " << file << "\n";
+      }
+    }
+
+    std::vector<G4LogicalVolume*> lvs(in.get<std::uint32_t>());
+    for (auto& lv: lvs) {
+      std::string const name = in.getString();
+      G4VSolid* solid = solids.at(in.get<std::uint32_t>());
+      G4Material* material = materials.at(in.get<std::uint32_t>());
+      lv = new G4LogicalVolume(solid, material, name);
+      if (in.get<std::uint8_t>()) {
+        auto const rgba = in.getDoubles(4);
+        auto vis = new G4VisAttributes(G4Colour(rgba[0], rgba[1], rgba[2], rgba[3]));
+        vis->SetVisibility(in.get<std::uint8_t>());
+        lv->SetVisAttributes(vis);
+      }
+    }
+
+    G4VPhysicalVolume* world = nullptr;
+    std::vector<G4VPhysicalVolume*> pvs(in.get<std::uint32_t>());
+    for (auto& pv: pvs) {
+      std::string const name = in.getString();
+      G4LogicalVolume* lv = lvs.at(in.get<std::uint32_t>());
+      auto const mother = in.get<std::int64_t>();
+      auto const copyNo = in.get<std::int32_t>();
+      bool const many = in.get<std::uint8_t>();
+      G4RotationMatrix* rotation = nullptr;
+      if (in.get<std::uint8_t>()) {
+        auto const r = in.getDoubles(9);
+        rotation = new G4RotationMatrix(CLHEP::HepRep3x3(r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], r[8]));
+      }
+      auto const t = in.getDoubles(3);
+      pv = new G4PVPlacement(rotation, G4ThreeVector(t[0], t[1], t[2]), lv, name,
+                             (mother < 0) ? nullptr : lvs.at(mother), many, copyNo);
+      if (mother < 0) world = pv;
+    }
+
+    std::vector<G4OpticalSurface*> surfaces(in.get<std::uint32_t>());
+    for (auto& surface: surfaces) {
+      std::string const name = in.getString();
+      auto const model = static_cast<G4OpticalSurfaceModel>(in.get<std::int32_t>());
+      auto const finish = static_cast<G4OpticalSurfaceFinish>(in.get<std::int32_t>());
+      auto const type = static_cast<G4SurfaceType>(in.get<std::int32_t>());
+      double const polish = in.get<double>();
+      double const sigmaAlpha = in.get<double>();
+      surface = new G4OpticalSurface(name, model, finish, type, polish);
+      surface->SetPolish(polish);
+      surface->SetSigmaAlpha(sigmaAlpha);
+      if (auto table = getProperties(in)) surface->SetMaterialPropertiesTable(table);
+    }
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+      std::string const name = in.getString();
+      G4VPhysicalVolume* pv1 = pvs.at(in.get<std::uint32_t>());
+      G4VPhysicalVolume* pv2 = pvs.at(in.get<std::uint32_t>());
+      new G4LogicalBorderSurface(name, pv1, pv2, surfaces.at(in.get<std::uint32_t>()));
+    }
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+      std::string const name = in.getString();
+      G4LogicalVolume* lv = lvs.at(in.get<std::uint32_t>());
+      new G4LogicalSkinSurface(name, lv, surfaces.at(in.get<std::uint32_t>()));
+    }
+
+    auxMap.clear();
+    for (auto n = in.get<std::uint32_t>(); n > 0; --n) {
+      G4GDMLAuxListType& auxList = auxMap[lvs.at(in.get<std::uint32_t>())];
+      for (auto m = in.get<std::uint32_t>(); m > 0; --m) {
+        G4GDMLAuxStructType aux;
+        aux.type = in.getString();
+        aux.value = in.getString();
+        aux.unit = in.getString();
+        aux.auxList = nullptr;
+        auxList.push_back(aux);
+      }
+    }
+
+    if (!in.atEnd() || !world) {
+      throw cet::exception("GeometryCache") << "Inconsistent geometry cache " << file << "\n";
+    }
+    return world;
+  }
+
+} // namespace larg4
@@ -0,0 +1,60 @@
+// GeometryCache.h
+//
+// Binary cache of a geometry read from GDML, so that later jobs skip the
+// Xerces parse and the evaluation of the GDML expressions and loops. A cache
+// file holds what the GDML reader builds and larg4 uses:
+//   - isotopes, elements and materials, with their material properties;
+//   - solids, logical volumes (with their colour) and placements;
+//   - optical surfaces and the border and skin surfaces using them;
+//   - the auxiliary information of the volumes (SensDet, StepLimit, Efield,
+//     AuxDet...), without nested auxiliary lists.
+// Everything is rebuilt in the order of the Geant4 stores, from the values
+// of the original objects (doubles are stored bit for bit), so the volume
+// tree, copy numbers and daughter order are those of the GDML read. NIST
+// elements and materials are stored by name and rebuilt by G4NistManager, so
+// they keep their NIST identity; materials made of other materials are
+// rebuilt from their elements, by mass fraction or atom count as they were.
+// larg4_check_geometry_cache checks the round trip on a GDML file.
+//
+// Only geometries made of the supported objects are cached: solids G4Box,
+// G4Tubs, G4Cons, G4Trd, G4Sphere, G4Torus, G4Polycone and boolean or
+// displaced combinations of them; placements (no replicas or parameterised
+// volumes); materials not derived from a base material nor made from Z and A
+// (<material Z="...">). Others are read from GDML at every job.
+//
+// A file starts with a format version and the key it was written for (the
+// hash of the GDML files), and ends with the hash of its content: a missing,
+// stale or damaged file is rejected before anything is built.
+
+#ifndef LARG4_GEOMETRYCACHE_H
+#define LARG4_GEOMETRYCACHE_H
+
+#include "Geant4/G4GDMLReadStructure.hh" // G4GDMLAuxMapType
+
+#include <string>
+
+class G4VPhysicalVolume;
+
+namespace larg4 {
+
+  /// Writes the geometry of the Geant4 stores (`world`: its top volume) and
+  /// the auxiliary information of its volumes to `file`. Returns an empty
+  /// string, or why the geometry cannot be cached (nothing is written then).
+  std::string writeGeometryCache(std::string const& file, std::string const& key,
+                                 G4VPhysicalVolume const* world, G4GDMLAuxMapType const& auxMap);
+
+  /// Content of a GDML file followed by the name and content of every file
+  /// it pulls in (external entities and modular <file name="..."/>
+  /// references), to key the caches of a geometry. It does not depend on
+  /// where the files are.
+  std::string gdmlContent(std::string const& path);
+
+  /// Builds the geometry stored in `file`, if it was written for `key`, and
+  /// fills `auxMap`. Returns the world volume, or nullptr (and builds
+  /// nothing) if the file is missing, stale or damaged.
+  G4VPhysicalVolume* readGeometryCache(std::string const& file, std::string const& key,
+                                       G4GDMLAuxMapType& auxMap);
+
+} // namespace larg4
+
+#endif // LARG4_GEOMETRYCACHE_H
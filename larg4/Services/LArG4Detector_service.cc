@@ -16,6 +16,26 @@
 //    }
 //   }
 // </pre>
+// The optional table SimEnergyDepositSD configures the SimEnergyDeposit
+// sensitive detectors (see SimEnergyDepositSD.h), e.g. to coalesce steps:
+//    SimEnergyDepositSD: { coalescing: "track" maxLength: 0.3 maxTime: 1. }
+// and the optional table AuxDetSD the auxiliary detectors (see AuxDetSD.h);
+// with AuxDetSD: { channels: "channelMap" } their hits are identified by
+// (AuxDet, sensitive volume) channels, the AuxDets being the volumes with the
+// GDML auxiliary AuxDet (see AuxDetChannelMap.h), and with
+// AuxDetSD: { timeWindow: 100. } their hits are split in 100 ns windows and
+// come with the index products <instance>DetectorIDs and DetectorOffsets.
+// At the end of each event the sensitive detectors are finalized and their
+// products built in parallel tasks with ParallelSDFinalization: true (not
+// with SimEnergyDeposit detectors drawing photon fluctuations, see below).
+// With GeometryCacheDir set, the geometry is cached in a binary file named
+// after the hash of the GDML files (see GeometryCache.h), which later jobs
+// read instead of parsing the GDML; overlap check results are cached there too
+// (CheckOverlaps checks serially; larg4_check_overlaps checks in parallel,
+// outside of art, and fills the same cache).
+// The electric field of a volume is uniform (GDML auxiliary Efield) or read
+// from a field map file (see ElectricFieldMap.h):
+//    ElectricFieldMaps: { volTPCActiveInner: "sce_field.efm" }
 // Author: Hans Wenzel (Fermilab)
 // Modified: David Rivera
 //=============================================================================
@@ -24,6 +44,10 @@
 #include "cetlib/search_path.h"
  // larg4 includes:
 #include "larg4/Services/LArG4Detector_service.h"
+#include "larg4/Services/ContentHash.h"
+#include "larg4/Services/GeometryCache.h"
+#include "larg4/Services/OverlapCheck.h"
+#include "larg4/Services/TimingRecorder.h"
 // artg4tk includes:
 #include "artg4tk/pluginDetectors/gdml/ColorReader.hh"
 #include "artg4tk/pluginDetectors/gdml/CalorimeterSD.hh"
@@ -41,6 +65,9 @@
 #include "lardataobj/Simulation/AuxDetHit.h"
 #include "artg4tk/pluginDetectors/gdml/HadInteractionSD.hh"
 #include "artg4tk/pluginDetectors/gdml/HadIntAndEdepTrkSD.hh"
+#include "artg4tk/services/DetectorHolder_service.hh"
+#include "art/Framework/Principal/Event.h"
+#include "art/Framework/Services/Registry/ServiceHandle.h"
 //
 // Geant 4 includes:
 #include "Geant4/G4SDManager.hh"
@@ -58,10 +85,56 @@
 #include "Geant4/G4Types.hh"
 #include "Geant4/G4AutoDelete.hh"
 
+#include "boost/filesystem.hpp"
+#include "tbb/parallel_for.h"
+
 // C++ includes
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <set>
 #include <unordered_map>
+#include <vector>
 using std::string;
 
+namespace {
+  // -- merging of the products of consecutive sub-events of one art event
+  template <typename T>
+  void mergeSubEvent(std::vector<T>& dst, std::vector<T>&& src)
+  {
+    dst.insert(dst.end(), std::make_move_iterator(src.begin()), std::make_move_iterator(src.end()));
+  }
+
+  template <typename K, typename V>
+  void mergeSubEvent(std::map<K, V>& dst, std::map<K, V>&& src)
+  {
+    for (auto const& [key, value] : src) dst[key] += value;
+  }
+
+  // only the first hadronic interaction of the art event is kept: the first
+  // non-empty vertex of the sub-events
+  void mergeSubEvent(artg4tk::ArtG4tkVtx& dst, artg4tk::ArtG4tkVtx&& src)
+  {
+    if (dst.GetNumOutcoming() == 0) dst = std::move(src);
+  }
+}
+
+template <typename T>
+struct larg4::LArG4DetectorService::PendingProductOf : larg4::LArG4DetectorService::PendingProduct {
+  std::unique_ptr<T> product;
+  void put(art::Event& e, std::string const& instance) override { e.put(std::move(product), instance); }
+  void putOrStash(LArG4DetectorService& self, art::Event& e, std::string const& instance) override
+  { self.putOrStash(e, std::move(product), instance); }
+};
+
+template <typename T>
+void larg4::LArG4DetectorService::addProduct(Products& products, std::unique_ptr<T>&& product, std::string const& instance) {
+  auto pending = std::make_unique<PendingProductOf<T>>();
+  pending->product = std::move(product);
+  products.emplace_back(instance, std::move(pending));
+}
+
 std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems) {
     std::stringstream ss(s);
     std::string item;
@@ -83,12 +156,21 @@ larg4::LArG4DetectorService::LArG4DetectorService(fhicl::ParameterSet const & p)
                         p.get<string>("mother_category", "")),
   gdmlFileName_( p.get<std::string>("gdmlFileName_","")),
   checkoverlaps_( p.get<bool>("CheckOverlaps",false)),
+  overlapResolution_( p.get<int>("CheckOverlapsResolution",1000)),
+  overlapTolerance_( p.get<double>("CheckOverlapsTolerance",0.)),
+  overlapReportFile_( p.get<std::string>("OverlapReportFile","")),
   volumeNames_( p.get<std::vector<std::string>>("volumeNames",{}) ),
   stepLimits_( p.get<std::vector<float>>("stepLimits",{}) ),
   inputVolumes_(0),
   dumpMP_( p.get<bool>("DumpMaterialProperties",false)),
+  geometryCacheDir_( p.get<std::string>("GeometryCacheDir","")),
+  sedConfig_( p.get<fhicl::ParameterSet>("SimEnergyDepositSD",fhicl::ParameterSet())),
+  auxDetConfig_( p.get<fhicl::ParameterSet>("AuxDetSD",fhicl::ParameterSet())),
+  parallelHarvest_( p.get<bool>("ParallelSDFinalization",false)),
+  fieldMapFiles_( p.get<fhicl::ParameterSet>("ElectricFieldMaps",fhicl::ParameterSet())),
   logInfo_( "LArG4DetectorService" ),
-  DetectorList(0)
+  firstSubEvent_(true),
+  lastSubEvent_(true)
 {
   setGDMLVolumes_.clear();
   overrideGDMLStepLimit_Map.clear();
@@ -126,16 +208,46 @@ larg4::LArG4DetectorService::~LArG4DetectorService() {
 }
 
 std::vector<G4LogicalVolume *> larg4::LArG4DetectorService::doBuildLVs() {
-    ColorReader reader;
-    G4GDMLParser parser(&reader);
-    parser.SetOverlapCheck(checkoverlaps_);
     cet::search_path sp{"FW_SEARCH_PATH"};
     std::string fullGDMLFileName;
     if (!sp.find_file(gdmlFileName_, fullGDMLFileName)) {
       throw cet::exception("LArG4DetectorService") << "Cannot find file: " << gdmlFileName_;
     }
-    parser.Read(fullGDMLFileName);
-    G4VPhysicalVolume *World = parser.GetWorldVolume();
+
+    // -- with GeometryCacheDir, the geometry is read from the binary cache of
+    //    the GDML files if there is one, and cached after the GDML read if not
+    std::string geometryCacheKey, geometryCache;
+    if (!geometryCacheDir_.empty()) {
+      geometryCacheKey = contentHash(gdmlContent(fullGDMLFileName));
+      geometryCache = geometryCacheDir_ + "/" + geometryCacheKey + ".geometry";
+    }
+    G4GDMLAuxMapType auxMap;
+    G4VPhysicalVolume *World = geometryCache.empty() ? nullptr :
+      readGeometryCache(geometryCache, geometryCacheKey, auxMap);
+    if (World) {
+      mf::LogInfo("LArG4DetectorService::doBuildLVs") << "Geometry read from cache " << geometryCache;
+    }
+    else {
+      // -- overlaps are not checked while reading (serially, volume after
+      //    volume) but afterwards by checkOverlaps()
+      ColorReader reader;
+      G4GDMLParser parser(&reader);
+      parser.Read(fullGDMLFileName);
+      World = parser.GetWorldVolume();
+      auxMap = *parser.GetAuxMap();
+      if (!geometryCache.empty()) {
+        boost::system::error_code ec;
+        boost::filesystem::create_directories(geometryCacheDir_, ec);
+        std::string const why = writeGeometryCache(geometryCache, geometryCacheKey, World, auxMap);
+        if (why.empty()) {
+          mf::LogInfo("LArG4DetectorService::doBuildLVs") << "Geometry cached in " << geometryCache;
+        } else {
+          MF_LOG_WARNING("LArG4DetectorService::doBuildLVs") << "Geometry not cached: " << why;
+        }
+      }
+    }
+
+    if (checkoverlaps_) checkOverlaps(fullGDMLFileName);
 
     std::stringstream ss;
     ss << World->GetTranslation() << "\n\n";
@@ -150,13 +262,15 @@ std::vector<G4LogicalVolume *> larg4::LArG4DetectorService::doBuildLVs() {
        << " physical volumes."
        << "\n\n";
     G4SDManager* SDman = G4SDManager::GetSDMpointer();
-    const G4GDMLAuxMapType* auxmap = parser.GetAuxMap();
+    const G4GDMLAuxMapType* auxmap = &auxMap;
     ss << "Found " << auxmap->size()
        << " volume(s) with auxiliary information."
        << "\n\n";
     ss << "%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%\n";
     mf::LogInfo("LArG4DetectorService::doBuildLVs") << ss.str();
 
+    std::map<G4LogicalVolume*, double> efields; // [kV/cm]
+    std::set<G4LogicalVolume const*> auxDetVolumes;
     for (G4GDMLAuxMapType::const_iterator iter = auxmap->begin();
         iter != auxmap->end(); iter++)
     {
@@ -206,78 +320,93 @@ std::vector<G4LogicalVolume *> larg4::LArG4DetectorService::doBuildLVs() {
                         << " from the GDML file.";
                 setGDMLVolumes_.insert(std::make_pair( ((*iter).first)->GetName(), (float)(value/CLHEP::mm) ));
             }
+            if ((*vit).type == "Efield") {
+                if (provided_category == "Electric field") {
+                  efields[(*iter).first] = value / (CLHEP::kilovolt / CLHEP::cm);
+                } else if (provided_category == "NONE") {
+                  MF_LOG_WARNING("EfieldUnit") << "Efield in geometry file does not have a unit!"
+                                               << " Defaulting to V/cm...";
+                  efields[(*iter).first] = value * 1e-3;
+                } else {
+                  throw cet::exception("EfieldUnit") << "Efield does not have a valid electric field unit!\n"
+                                                     << " Category of unit provided = " << provided_category << ".\n";
+                }
+            }
+            if ((*vit).type == "AuxDet") auxDetVolumes.insert((*iter).first);
             if ((*vit).type == "SensDet") {
-                if ((*vit).value == "DRCalorimeter") {
-                    G4String name = ((*iter).first)->GetName() + "_DRCalorimeter";
-                    artg4tk::DRCalorimeterSD* aDRCalorimeterSD = new artg4tk::DRCalorimeterSD(name);
-                    SDman->AddNewDetector(aDRCalorimeterSD);
-                    ((*iter).first)->SetSensitiveDetector(aDRCalorimeterSD);
-                    std::cout << "Attaching sensitive Detector: " << (*vit).value
-                            << " to Volume:  " << ((*iter).first)->GetName() << "\n";
-                    DetectorList.push_back(std::make_pair((*iter).first->GetName(), (*vit).value));
-                } else if ((*vit).value == "Calorimeter") {
-                    G4String name = ((*iter).first)->GetName() + "_Calorimeter";
-                    artg4tk::CalorimeterSD* aCalorimeterSD = new artg4tk::CalorimeterSD(name);
-                    SDman->AddNewDetector(aCalorimeterSD);
-                    ((*iter).first)->SetSensitiveDetector(aCalorimeterSD);
-                    std::cout << "Attaching sensitive Detector: " << (*vit).value
-                            << " to Volume:  " << ((*iter).first)->GetName() << "\n";
-                    DetectorList.push_back(std::make_pair((*iter).first->GetName(), (*vit).value));
-                } else if ((*vit).value == "PhotonDetector") {
-                    G4String name = ((*iter).first)->GetName() + "_PhotonDetector";
-                    artg4tk::PhotonSD* aPhotonSD = new artg4tk::PhotonSD(name);
-                    SDman->AddNewDetector(aPhotonSD);
-                    ((*iter).first)->SetSensitiveDetector(aPhotonSD);
-                    std::cout << "Attaching sensitive Detector: " << (*vit).value
-                            << " to Volume:  " << ((*iter).first)->GetName() << "\n";
-                    DetectorList.push_back(std::make_pair((*iter).first->GetName(), (*vit).value));
-                } else if ((*vit).value == "Tracker") {
-                    G4String name = ((*iter).first)->GetName() + "_Tracker";
-                    artg4tk::TrackerSD* aTrackerSD = new artg4tk::TrackerSD(name);
-                    SDman->AddNewDetector(aTrackerSD);
-                    ((*iter).first)->SetSensitiveDetector(aTrackerSD);
-                    std::cout << "Attaching sensitive Detector: " << (*vit).value
-                            << " to Volume:  " << ((*iter).first)->GetName() << "\n";
-                    DetectorList.push_back(std::make_pair((*iter).first->GetName(), (*vit).value));
-                } else if ((*vit).value == "SimEnergyDeposit") {
-                    G4String name = ((*iter).first)->GetName() + "_SimEnergyDeposit";
-                    SimEnergyDepositSD * aSimEnergyDepositSD = new SimEnergyDepositSD(name);
-                    SDman->AddNewDetector(aSimEnergyDepositSD);
-                    ((*iter).first)->SetSensitiveDetector(aSimEnergyDepositSD);
-                    std::cout << "Attaching sensitive Detector: " << (*vit).value
-                            << " to Volume:  " << ((*iter).first)->GetName() << "\n";
-                    DetectorList.push_back(std::make_pair((*iter).first->GetName(), (*vit).value));
-                } else if ((*vit).value == "AuxDet") {
-                    G4String name = ((*iter).first)->GetName() + "_AuxDet";
-                    AuxDetSD * aAuxDetSD = new AuxDetSD(name);
-                    SDman->AddNewDetector(aAuxDetSD);
-                    ((*iter).first)->SetSensitiveDetector(aAuxDetSD);
-                    std::cout << "Attaching sensitive Detector: " << (*vit).value
-                            << " to Volume:  " << ((*iter).first)->GetName() << "\n";
-                    DetectorList.push_back(std::make_pair((*iter).first->GetName(), (*vit).value));
-                } else if ((*vit).value == "HadInteraction") {
-                    G4String name = ((*iter).first)->GetName() + "_HadInteraction";
-                    artg4tk::HadInteractionSD* aHadInteractionSD = new artg4tk::HadInteractionSD(name);
-                    // NOTE: This will be done in the HadInteractionSD ctor
-                    // SDman->AddNewDetector(aHadInteractionSD);
-                    ((*iter).first)->SetSensitiveDetector(aHadInteractionSD);
-                    std::cout << "Attaching sensitive Detector: " << (*vit).value
-                            << " to Volume:  " << ((*iter).first)->GetName() << "\n";
-                    DetectorList.push_back(std::make_pair((*iter).first->GetName(), (*vit).value));
-                } else if ((*vit).value == "HadIntAndEdepTrk") {
-                    G4String name = ((*iter).first)->GetName() + "_HadIntAndEdepTrk";
-                    artg4tk::HadIntAndEdepTrkSD* aHadIntAndEdepTrkSD = new artg4tk::HadIntAndEdepTrkSD(name);
-                    // NOTE: This will be done in the HadIntAndEdepTrkSD ctor
-                    // SDman->AddNewDetector(aHadIntAndEdepTrkSD);
-                    ((*iter).first)->SetSensitiveDetector(aHadIntAndEdepTrkSD);
-                    std::cout << "Attaching sensitive Detector: " << (*vit).value
-                            << " to Volume:  " << ((*iter).first)->GetName() << "\n";
-                    DetectorList.push_back(std::make_pair((*iter).first->GetName(), (*vit).value));
+                auto const type = sdTypes().find((*vit).value);
+                if (type == sdTypes().end()) {
+                    MF_LOG_WARNING("LArG4DetectorService::doBuildLVs") << "Unknown sensitive detector type "
+                        << (*vit).value << " for volume " << ((*iter).first)->GetName() << ": ignored";
+                    continue;
                 }
+                G4String name = ((*iter).first)->GetName() + "_" + (*vit).value;
+                G4VSensitiveDetector* sd = type->second.make(*this, name);
+                ((*iter).first)->SetSensitiveDetector(sd);
+                std::cout << "Attaching sensitive Detector: " << (*vit).value
+                        << " to Volume:  " << ((*iter).first)->GetName() << "\n";
+                harvesters_.push_back({sd, &type->second, myName() + ((*iter).first)->GetName(),
+                                       TimingRecorder::instance().slot("SD/" + name + "/fill")});
             }
         }
         std::cout << "%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%\n";
     }
+    // -- detectors drawing photon fluctuations share the ScintEngine of
+    //    larg4Main, which is not thread safe: they are finalized serially, in
+    //    a fixed order, so that the results are also reproducible
+    if (parallelHarvest_) {
+        for (auto const& h : harvesters_) {
+            auto const* sedsd = dynamic_cast<SimEnergyDepositSD const*>(h.sd);
+            if (sedsd && sedsd->UsesRandomEngine()) {
+                parallelHarvest_ = false;
+                MF_LOG_WARNING("LArG4DetectorService::doBuildLVs") << "ParallelSDFinalization ignored: "
+                    << h.sd->GetName() << " draws photon fluctuations from the shared random engine";
+                break;
+            }
+        }
+    }
+    // -- readout channels of the AuxDet detectors that use them
+    std::set<G4LogicalVolume const*> auxDetSensitive;
+    for (auto const* lv : *G4LogicalVolumeStore::GetInstance()) {
+        auto const* auxsd = dynamic_cast<AuxDetSD const*>(lv->GetSensitiveDetector());
+        if (auxsd && auxsd->UsesChannelMap()) auxDetSensitive.insert(lv);
+    }
+    if (!auxDetSensitive.empty()) {
+        auxDetChannelMap_ = std::make_shared<AuxDetChannelMap const>(World, auxDetSensitive, auxDetVolumes);
+        for (auto const* lv : auxDetSensitive) {
+            static_cast<AuxDetSD*>(lv->GetSensitiveDetector())->SetChannelMap(auxDetChannelMap_);
+        }
+        mf::LogInfo("LArG4DetectorService::doBuildLVs") << "AuxDet channel map: "
+            << auxDetChannelMap_->nAuxDets() << " AuxDets ("
+            << (auxDetVolumes.empty() ? "mothers of the sensitive volumes" : "GDML auxiliary AuxDet") << ") x "
+            << auxDetChannelMap_->sensitivePerAuxDet() << " sensitive volumes";
+    }
+    // -- electric fields: uniform from the GDML file, or maps (which win)
+    for (auto const& [volume, field] : efields) {
+        fieldMaps_[volume->GetName()] = std::make_shared<ElectricFieldMap const>(field);
+        mf::LogInfo("LArG4DetectorService::doBuildLVs") << "Electric field of " << volume->GetName()
+                                                        << ": " << field << " kV/cm";
+    }
+    for (auto const& volume : fieldMapFiles_.get_names()) {
+        if (!G4LogicalVolumeStore::GetInstance()->GetVolume(volume, false)) {
+            throw cet::exception("LArG4DetectorService") << "ElectricFieldMaps: no volume named " << volume << "\n";
+        }
+        std::string fileName;
+        if (!sp.find_file(fieldMapFiles_.get<std::string>(volume), fileName)) {
+            throw cet::exception("LArG4DetectorService") << "Cannot find file: "
+                                                         << fieldMapFiles_.get<std::string>(volume);
+        }
+        fieldMaps_[volume] = std::make_shared<ElectricFieldMap const>(fileName);
+        mf::LogInfo("LArG4DetectorService::doBuildLVs") << "Electric field of " << volume
+                                                        << ": map " << fileName;
+    }
+    // -- the yield models of the SimEnergyDeposit detectors use the field of their volume
+    for (auto const& [volume, map] : fieldMaps_) {
+        G4LogicalVolume* lv = G4LogicalVolumeStore::GetInstance()->GetVolume(volume, false);
+        if (auto sedsd = dynamic_cast<SimEnergyDepositSD*>(lv->GetSensitiveDetector())) {
+            sedsd->SetElectricFieldMap(map);
+        }
+    }
     if (dumpMP_)
     {
       G4cout << *(G4Material::GetMaterialTable()) << G4endl;
@@ -309,6 +438,58 @@ std::vector<G4VPhysicalVolume *> larg4::LArG4DetectorService::doPlaceToPVs(std::
     return myPVvec;
 }
 
+void larg4::LArG4DetectorService::checkOverlaps(std::string const& gdmlFile) {
+  // -- the result is cached under the hash of the settings and of the
+  //    geometry files: an unchanged geometry is not checked again. The check
+  //    here is serial: forking or threads in the art process are not safe;
+  //    larg4_check_overlaps checks in parallel and fills the same cache.
+  std::string cachedReport;
+  if (!geometryCacheDir_.empty()) {
+    cachedReport = overlapReportCacheFile(geometryCacheDir_, gdmlFile,
+                                          overlapResolution_, overlapTolerance_);
+  }
+
+  std::string report;
+  if (!cachedReport.empty() && readOverlapReport(cachedReport, report)) {
+    mf::LogInfo("LArG4DetectorService::checkOverlaps") << "Using cached overlap check " << cachedReport;
+  }
+  else {
+    std::vector<G4VPhysicalVolume*> const volumes(G4PhysicalVolumeStore::GetInstance()->begin(),
+                                                  G4PhysicalVolumeStore::GetInstance()->end());
+    mf::LogInfo("LArG4DetectorService::checkOverlaps") << "Checking " << volumes.size()
+      << " volumes for overlaps (larg4_check_overlaps " << gdmlFile << " --resolution "
+      << overlapResolution_ << " --tolerance " << overlapTolerance_
+      << " --cache-dir <GeometryCacheDir> checks in parallel)";
+    report = overlapReport(overlapResolution_, overlapTolerance_,
+                           findOverlaps(volumes, 0, 1, overlapResolution_, overlapTolerance_));
+
+    if (!cachedReport.empty()) {
+      boost::system::error_code ec;
+      boost::filesystem::create_directories(geometryCacheDir_, ec);
+      if (!storeOverlapReport(cachedReport, report)) {
+        MF_LOG_WARNING("LArG4DetectorService::checkOverlaps") << "Could not store " << cachedReport;
+      }
+    }
+  }
+
+  if (!overlapReportFile_.empty()) {
+    std::ofstream out(overlapReportFile_);
+    out << report;
+    if (!out) {
+      throw cet::exception("LArG4DetectorService") << "Cannot write overlap report: "
+                                                   << overlapReportFile_ << "\n";
+    }
+  }
+
+  std::istringstream in(report);
+  for (std::string line; std::getline(in, line);) {
+    if (line.empty() || line[0] == '#') continue;
+    MF_LOG_WARNING("LArG4DetectorService::checkOverlaps") << "Overlap (volume, copy, mother): " << line;
+  }
+  mf::LogInfo("LArG4DetectorService::checkOverlaps") << "Overlap check: " << overlapCount(report)
+    << " overlapping volume(s)";
+}
+
 void larg4::LArG4DetectorService::setStepLimits() {
   // -- D. Rivera : This function sets step limits for volumes provided in the configuration file
   //                and overrides the step limit (if any) set for the same volumes but from the GMDL
@@ -368,150 +549,268 @@ void larg4::LArG4DetectorService::setStepLimits() {
 
 void larg4::LArG4DetectorService::doCallArtProduces(art::ProducesCollector& collector) {
     // Tell Art what we produce, and label the entries
-    std::vector<std::pair<std::string, std::string> >::const_iterator cii;
-    for (cii = DetectorList.begin(); cii != DetectorList.end(); cii++) {
-        if ((*cii).second == "DRCalorimeter") {
-            std::string identifier = myName() +(*cii).first;
-            collector.produces<artg4tk::DRCalorimeterHitCollection>(identifier);
-            std::string EdepID = identifier + "Edep";
-            collector.produces<artg4tk::ByParticle>(EdepID);
-            std::string NCerenID = identifier + "NCeren";
-            collector.produces<artg4tk::ByParticle>(NCerenID);
-        } else if ((*cii).second == "Calorimeter") {
-            std::string identifier = myName() +(*cii).first;
-            collector.produces<artg4tk::CalorimeterHitCollection>(identifier);
-        } else if ((*cii).second == "PhotonDetector") {
-            std::string identifier = myName() + (*cii).first;
-            collector.produces<artg4tk::PhotonHitCollection>(identifier);
-        } else if ((*cii).second == "Tracker") {
-            std::string identifier = myName()+(*cii).first;
-            collector.produces<artg4tk::TrackerHitCollection>(identifier);
-        } else if ((*cii).second == "SimEnergyDeposit") {
-            std::string identifier = myName() + (*cii).first;
-            collector.produces<sim::SimEnergyDepositCollection>(identifier);
-        } else if ((*cii).second == "AuxDet") {
-            std::string identifier = myName() + (*cii).first;
-            collector.produces<sim::AuxDetHitCollection>(identifier);
-        } else if ((*cii).second == "HadInteraction") {
-            // std::string identifier = myName() + (*cii).first;
-            collector.produces<artg4tk::ArtG4tkVtx>(); // do NOT use product instance name (for now)
-        } else if ((*cii).second == "HadIntAndEdepTrk") {
-            collector.produces<artg4tk::ArtG4tkVtx>();
-            collector.produces<artg4tk::TrackerHitCollection>();
-        }
+    for (auto const& h : harvesters_) {
+        h.type->produces(h.sd, collector, h.instance);
     }
 }
 
-void larg4::LArG4DetectorService::doFillEventWithArtHits(G4HCofThisEvent * myHC) {
-    //
-    // NOTE(JVY): 1st hadronic interaction will be fetched as-is from HadInteractionSD
-    //            a copy (via copy ctor) will be placed directly into art::Event
-    //
-    std::vector<std::pair<std::string, std::string> >::const_iterator cii;
-    //    std::cout << "****************Detectorlist size:  " << DetectorList.size() << std::endl;
-    for (cii = DetectorList.begin(); cii != DetectorList.end(); cii++) {
-        std::string sdname = (*cii).first + "_" + (*cii).second;
-        //  std::cout << "****************SDNAME:" << sdname << std::endl;
-        if ((*cii).second == "HadInteraction") {
-            G4SDManager* sdman = G4SDManager::GetSDMpointer();
-            artg4tk::HadInteractionSD* hisd = dynamic_cast<artg4tk::HadInteractionSD*> (sdman->FindSensitiveDetector(sdname));
-            if (hisd) {
+void larg4::LArG4DetectorService::setSubEvent(bool first, bool last, int trackIDOffset) {
+    firstSubEvent_ = first;
+    lastSubEvent_ = last;
+    if (first) pendingProducts_.clear();
+    // -- larg4 hits carry the (offset) track IDs of the particle list
+    for (auto const& h : harvesters_) {
+        if (h.type->setTrackIDOffset) h.type->setTrackIDOffset(h.sd, trackIDOffset);
+    }
+}
+
+std::vector<std::string> larg4::LArG4DetectorService::sdsWithoutTrackIDOffset() const {
+    std::vector<std::string> names;
+    for (auto const& h : harvesters_) {
+        if (!h.type->setTrackIDOffset) names.push_back(h.sd->GetName());
+    }
+    return names;
+}
+
+std::shared_ptr<larg4::ElectricFieldMap const>
+larg4::LArG4DetectorService::electricFieldMap(std::string const& volume) const {
+    auto const it = fieldMaps_.find(volume);
+    return (it != fieldMaps_.end()) ? it->second : nullptr;
+}
+
+bool larg4::LArG4DetectorService::usesRandomEngine() const {
+    for (auto const& h : harvesters_) {
+        auto const* sedsd = dynamic_cast<SimEnergyDepositSD const*>(h.sd);
+        if (sedsd && sedsd->UsesRandomEngine()) return true;
+    }
+    return false;
+}
+
+void larg4::LArG4DetectorService::setRandomEngine(CLHEP::HepRandomEngine* engine) {
+    for (auto const& h : harvesters_) {
+        if (auto sedsd = dynamic_cast<SimEnergyDepositSD*>(h.sd)) sedsd->SetRandomEngine(engine);
+    }
+}
+
+template <typename T>
+void larg4::LArG4DetectorService::putOrStash(art::Event& e, std::unique_ptr<T>&& product, std::string const& instance) {
+    if (firstSubEvent_ && lastSubEvent_) {
+        e.put(std::move(product), instance);
+        return;
+    }
+    auto& pending = pendingProducts_[std::make_pair(std::type_index(typeid(T)), instance)];
+    if (!pending) {
+        auto stash = std::make_unique<PendingProductOf<T>>();
+        stash->product = std::move(product);
+        pending = std::move(stash);
+    } else {
+        mergeSubEvent(*static_cast<PendingProductOf<T>&>(*pending).product, std::move(*product));
+    }
+}
+
+template <typename T>
+T* larg4::LArG4DetectorService::pendingProduct(std::string const& instance) {
+    auto const it = pendingProducts_.find(std::make_pair(std::type_index(typeid(T)), instance));
+    return (it != pendingProducts_.end()) ? static_cast<PendingProductOf<T>&>(*it->second).product.get() : nullptr;
+}
+
+void larg4::LArG4DetectorService::reindexTimeWindowedHits() {
+    for (auto const& h : harvesters_) {
+        auto const* auxsd = dynamic_cast<AuxDetSD const*>(h.sd);
+        if (!auxsd || !auxsd->TimeWindowed()) continue;
+        auto* hits = pendingProduct<sim::AuxDetHitCollection>(h.instance);
+        auto* detectorIDs = pendingProduct<std::vector<unsigned int>>(h.instance + "DetectorIDs");
+        auto* offsets = pendingProduct<std::vector<unsigned int>>(h.instance + "DetectorOffsets");
+        if (hits && detectorIDs && offsets) sortAndIndexAuxDetHits(*hits, *detectorIDs, *offsets);
+    }
+}
+
+std::map<std::string, larg4::LArG4DetectorService::SDType> const&
+larg4::LArG4DetectorService::sdTypes() {
+    // -- to support a new type of sensitive detector, add its entry here
+    static std::map<std::string, SDType> const types {
+        { "DRCalorimeter", {
+            [](LArG4DetectorService&, G4String const& name) -> G4VSensitiveDetector* {
+                auto sd = new artg4tk::DRCalorimeterSD(name);
+                G4SDManager::GetSDMpointer()->AddNewDetector(sd);
+                return sd;
+            },
+            [](G4VSensitiveDetector*, art::ProducesCollector& collector, std::string const& instance) {
+                collector.produces<artg4tk::DRCalorimeterHitCollection>(instance);
+                collector.produces<artg4tk::ByParticle>(instance + "Edep");
+                collector.produces<artg4tk::ByParticle>(instance + "NCeren");
+            },
+            [](G4VSensitiveDetector* sd, Products& products, std::string const& instance) {
+                auto drcalsd = static_cast<artg4tk::DRCalorimeterSD*>(sd);
+                addProduct(products, std::make_unique<artg4tk::DRCalorimeterHitCollection>(drcalsd->GetHits()), instance);
+                addProduct(products, std::make_unique<artg4tk::ByParticle>(drcalsd->GetEbyParticle()), instance + "Edep");
+                addProduct(products, std::make_unique<artg4tk::ByParticle>(drcalsd->GetNCerenbyParticle()), instance + "NCeren");
+            },
+            nullptr } },
+        { "Calorimeter", {
+            [](LArG4DetectorService&, G4String const& name) -> G4VSensitiveDetector* {
+                auto sd = new artg4tk::CalorimeterSD(name);
+                G4SDManager::GetSDMpointer()->AddNewDetector(sd);
+                return sd;
+            },
+            [](G4VSensitiveDetector*, art::ProducesCollector& collector, std::string const& instance) {
+                collector.produces<artg4tk::CalorimeterHitCollection>(instance);
+            },
+            [](G4VSensitiveDetector* sd, Products& products, std::string const& instance) {
+                auto calsd = static_cast<artg4tk::CalorimeterSD*>(sd);
+                addProduct(products, std::make_unique<artg4tk::CalorimeterHitCollection>(calsd->GetHits()), instance);
+            },
+            nullptr } },
+        { "PhotonDetector", {
+            [](LArG4DetectorService&, G4String const& name) -> G4VSensitiveDetector* {
+                auto sd = new artg4tk::PhotonSD(name);
+                G4SDManager::GetSDMpointer()->AddNewDetector(sd);
+                return sd;
+            },
+            [](G4VSensitiveDetector*, art::ProducesCollector& collector, std::string const& instance) {
+                collector.produces<artg4tk::PhotonHitCollection>(instance);
+            },
+            [](G4VSensitiveDetector* sd, Products& products, std::string const& instance) {
+                auto phsd = static_cast<artg4tk::PhotonSD*>(sd);
+                addProduct(products, std::make_unique<artg4tk::PhotonHitCollection>(phsd->GetHits()), instance);
+            },
+            nullptr } },
+        { "Tracker", {
+            [](LArG4DetectorService&, G4String const& name) -> G4VSensitiveDetector* {
+                auto sd = new artg4tk::TrackerSD(name);
+                G4SDManager::GetSDMpointer()->AddNewDetector(sd);
+                return sd;
+            },
+            [](G4VSensitiveDetector*, art::ProducesCollector& collector, std::string const& instance) {
+                collector.produces<artg4tk::TrackerHitCollection>(instance);
+            },
+            [](G4VSensitiveDetector* sd, Products& products, std::string const& instance) {
+                auto trsd = static_cast<artg4tk::TrackerSD*>(sd);
+                addProduct(products, std::make_unique<artg4tk::TrackerHitCollection>(trsd->GetHits()), instance);
+            },
+            nullptr } },
+        { "SimEnergyDeposit", {
+            [](LArG4DetectorService& self, G4String const& name) -> G4VSensitiveDetector* {
+                auto sd = new SimEnergyDepositSD(name, self.sedConfig_);
+                sd->SetDeferredFinalization(self.parallelHarvest_);
+                G4SDManager::GetSDMpointer()->AddNewDetector(sd);
+                return sd;
+            },
+            [](G4VSensitiveDetector*, art::ProducesCollector& collector, std::string const& instance) {
+                collector.produces<sim::SimEnergyDepositCollection>(instance);
+            },
+            [](G4VSensitiveDetector* sd, Products& products, std::string const& instance) {
+                // -- moved, not copied: the detector starts the next event empty
+                auto sedsd = static_cast<SimEnergyDepositSD*>(sd);
+                sedsd->FinalizeEvent();
+                addProduct(products, std::make_unique<sim::SimEnergyDepositCollection>(sedsd->ReleaseHits()), instance);
+            },
+            [](G4VSensitiveDetector* sd, int offset) {
+                static_cast<SimEnergyDepositSD*>(sd)->SetTrackIDOffset(offset);
+            } } },
+        { "AuxDet", {
+            [](LArG4DetectorService& self, G4String const& name) -> G4VSensitiveDetector* {
+                auto sd = new AuxDetSD(name, self.auxDetConfig_);
+                sd->SetDeferredFinalization(self.parallelHarvest_);
+                G4SDManager::GetSDMpointer()->AddNewDetector(sd);
+                return sd;
+            },
+            [](G4VSensitiveDetector* sd, art::ProducesCollector& collector, std::string const& instance) {
+                collector.produces<sim::AuxDetHitCollection>(instance);
+                if (static_cast<AuxDetSD*>(sd)->TimeWindowed()) {
+                    collector.produces<std::vector<unsigned int>>(instance + "DetectorIDs");
+                    collector.produces<std::vector<unsigned int>>(instance + "DetectorOffsets");
+                }
+            },
+            [](G4VSensitiveDetector* sd, Products& products, std::string const& instance) {
+                auto auxsd = static_cast<AuxDetSD*>(sd);
+                auxsd->FinalizeEvent();
+                addProduct(products, std::make_unique<sim::AuxDetHitCollection>(auxsd->ReleaseHits()), instance);
+                if (auxsd->TimeWindowed()) {
+                    addProduct(products, std::make_unique<std::vector<unsigned int>>(auxsd->ReleaseDetectorIDs()),
+                               instance + "DetectorIDs");
+                    addProduct(products, std::make_unique<std::vector<unsigned int>>(auxsd->ReleaseDetectorOffsets()),
+                               instance + "DetectorOffsets");
+                }
+            },
+            [](G4VSensitiveDetector* sd, int offset) {
+                static_cast<AuxDetSD*>(sd)->SetTrackIDOffset(offset);
+            } } },
+        // NOTE(JVY): 1st hadronic interaction will be fetched as-is from HadInteractionSD
+        //            a copy (via copy ctor) will be placed directly into art::Event
+        //            with NO product instance name (for now, at least)
+        { "HadInteraction", {
+            [](LArG4DetectorService&, G4String const& name) -> G4VSensitiveDetector* {
+                // NOTE: the HadInteractionSD ctor adds it to the SD manager
+                return new artg4tk::HadInteractionSD(name);
+            },
+            [](G4VSensitiveDetector*, art::ProducesCollector& collector, std::string const&) {
+                collector.produces<artg4tk::ArtG4tkVtx>();
+            },
+            [](G4VSensitiveDetector* sd, Products& products, std::string const&) {
+                auto hisd = static_cast<artg4tk::HadInteractionSD*>(sd);
                 const artg4tk::ArtG4tkVtx& inter = hisd->Get1stInteraction();
                 if (inter.GetNumOutcoming() > 0) {
-                    auto firstint = std::make_unique<artg4tk::ArtG4tkVtx>(inter);
-                    art::ServiceHandle<artg4tk::DetectorHolderService> detectorHolder;
-                    art::Event & e = detectorHolder -> getCurrArtEvent();
-                    e.put(std::move(firstint)); // note that there's NO product instance name (for now, at least)
-                    // (part of) the is that the name is encoded into the "collection"
-                    // which is NOT used in this specific case
+                    addProduct(products, std::make_unique<artg4tk::ArtG4tkVtx>(inter));
                 }
-                hisd->clear(); // clear out after movind info to EDM; no need to clea out in the producer !
-            }
-        } else if ((*cii).second == "HadIntAndEdepTrk") {
-            G4SDManager* sdman = G4SDManager::GetSDMpointer();
-            artg4tk::HadIntAndEdepTrkSD* sd = dynamic_cast<artg4tk::HadIntAndEdepTrkSD*> (sdman->FindSensitiveDetector(sdname));
-            if (sd) {
-                art::ServiceHandle<artg4tk::DetectorHolderService> detectorHolder;
-                art::Event & e = detectorHolder -> getCurrArtEvent();
-                const artg4tk::ArtG4tkVtx& inter = sd->Get1stInteraction();
+                hisd->clear(); // clear out after moving info to EDM; no need to clear out in the producer !
+            },
+            nullptr } },
+        { "HadIntAndEdepTrk", {
+            [](LArG4DetectorService&, G4String const& name) -> G4VSensitiveDetector* {
+                // NOTE: the HadIntAndEdepTrkSD ctor adds it to the SD manager
+                return new artg4tk::HadIntAndEdepTrkSD(name);
+            },
+            [](G4VSensitiveDetector*, art::ProducesCollector& collector, std::string const&) {
+                collector.produces<artg4tk::ArtG4tkVtx>();
+                collector.produces<artg4tk::TrackerHitCollection>();
+            },
+            [](G4VSensitiveDetector* sd, Products& products, std::string const&) {
+                auto hisd = static_cast<artg4tk::HadIntAndEdepTrkSD*>(sd);
+                const artg4tk::ArtG4tkVtx& inter = hisd->Get1stInteraction();
                 if (inter.GetNumOutcoming() > 0) {
-                    auto firstint = std::make_unique<artg4tk::ArtG4tkVtx>(inter);
-                    e.put(std::move(firstint)); // note that there's NO product instance name (for now, at least)
-                    // (part of) the is that the name is encoded into the "collection"
-                    // which is NOT used in this specific case
+                    addProduct(products, std::make_unique<artg4tk::ArtG4tkVtx>(inter));
                 }
-                const artg4tk::TrackerHitCollection& trkhits = sd->GetEdepTrkHits();
+                const artg4tk::TrackerHitCollection& trkhits = hisd->GetEdepTrkHits();
                 if (!trkhits.empty()) {
-                    auto hits = std::make_unique<artg4tk::TrackerHitCollection>(trkhits);
-                    e.put(std::move(hits));
+                    addProduct(products, std::make_unique<artg4tk::TrackerHitCollection>(trkhits));
                 }
-                sd->clear(); // clear out after moving info to EDM; no need to clea out in the producer !
-            }
-        } else if ((*cii).second == "Tracker") {
-            G4SDManager* sdman = G4SDManager::GetSDMpointer();
-            artg4tk::TrackerSD* trsd = dynamic_cast<artg4tk::TrackerSD*> (sdman->FindSensitiveDetector(sdname));
-            art::ServiceHandle<artg4tk::DetectorHolderService> detectorHolder;
-            art::Event & e = detectorHolder -> getCurrArtEvent();
-            const artg4tk::TrackerHitCollection& trkhits = trsd->GetHits();
-            auto hits = std::make_unique<artg4tk::TrackerHitCollection>(trkhits);
-            std::string identifier = myName()+(*cii).first;
-            e.put(std::move(hits), identifier);
-        }else if ( (*cii).second == "SimEnergyDeposit") {
-          G4SDManager* sdman = G4SDManager::GetSDMpointer();
-          SimEnergyDepositSD* sedsd = dynamic_cast<SimEnergyDepositSD*>(sdman->FindSensitiveDetector(sdname));
-          art::ServiceHandle<artg4tk::DetectorHolderService> detectorHolder;
-          art::Event & e = detectorHolder -> getCurrArtEvent();
-          const sim::SimEnergyDepositCollection& sedhits = sedsd->GetHits();
-          auto hits = std::make_unique<sim::SimEnergyDepositCollection>(sedhits);
-          std::string identifier=myName()+(*cii).first;
-          e.put(std::move(hits), identifier);
-        } else if ( (*cii).second == "AuxDet") {
-          G4SDManager* sdman = G4SDManager::GetSDMpointer();
-          AuxDetSD* auxsd = dynamic_cast<AuxDetSD*>(sdman->FindSensitiveDetector(sdname));
-          art::ServiceHandle<artg4tk::DetectorHolderService> detectorHolder;
-          art::Event & e = detectorHolder -> getCurrArtEvent();
-          const sim::AuxDetHitCollection& auxhits = auxsd->GetHits();
-          auto hits = std::make_unique<sim::AuxDetHitCollection>(auxhits);
-          std::string identifier=myName()+(*cii).first;
-          e.put(std::move(hits), identifier);
-        } else if ((*cii).second == "Calorimeter") {
-            G4SDManager* sdman = G4SDManager::GetSDMpointer();
-            artg4tk::CalorimeterSD* calsd = dynamic_cast<artg4tk::CalorimeterSD*> (sdman->FindSensitiveDetector(sdname));
-            art::ServiceHandle<artg4tk::DetectorHolderService> detectorHolder;
-            art::Event & e = detectorHolder -> getCurrArtEvent();
-            const artg4tk::CalorimeterHitCollection& calhits = calsd->GetHits();
-            auto hits = std::make_unique<artg4tk::CalorimeterHitCollection>(calhits);
-            std::string identifier = myName()+(*cii).first;
-            e.put(std::move(hits), identifier);
-        } else if ((*cii).second == "DRCalorimeter") {
-            G4SDManager* sdman = G4SDManager::GetSDMpointer();
-            artg4tk::DRCalorimeterSD* drcalsd = dynamic_cast<artg4tk::DRCalorimeterSD*> (sdman->FindSensitiveDetector(sdname));
-            art::ServiceHandle<artg4tk::DetectorHolderService> detectorHolder;
-            art::Event & e = detectorHolder -> getCurrArtEvent();
-            const artg4tk::DRCalorimeterHitCollection& drcalhits = drcalsd->GetHits();
-            auto hits = std::make_unique<artg4tk::DRCalorimeterHitCollection>(drcalhits);
-            std::string identifier = myName()+(*cii).first;
-            e.put(std::move(hits), identifier);
-            //
-            const artg4tk::ByParticle& edeps = drcalsd->GetEbyParticle();
-            auto edepsptr = std::make_unique<artg4tk::ByParticle>(edeps);
-            std::string edidentifier = myName()+(*cii).first + "Edep";
-            e.put(std::move(edepsptr), edidentifier);
-            //
-            const artg4tk::ByParticle& nceren = drcalsd->GetNCerenbyParticle();
-            auto ncerenptr = std::make_unique<artg4tk::ByParticle>(nceren);
-            std::string ncidentifier = myName()+(*cii).first + "NCeren";
-            e.put(std::move(ncerenptr), ncidentifier);
-        } else if ((*cii).second == "PhotonDetector") {
-            G4SDManager* sdman = G4SDManager::GetSDMpointer();
-            artg4tk::PhotonSD* phsd = dynamic_cast<artg4tk::PhotonSD*> (sdman->FindSensitiveDetector(sdname));
-            art::ServiceHandle<artg4tk::DetectorHolderService> detectorHolder;
-            art::Event & e = detectorHolder -> getCurrArtEvent();
-            const artg4tk::PhotonHitCollection& phhits = phsd->GetHits();
-            auto hits = std::make_unique<artg4tk::PhotonHitCollection>(phhits);
-            std::string identifier = myName()+(*cii).first;
-            e.put(std::move(hits), identifier);
+                hisd->clear(); // clear out after moving info to EDM; no need to clear out in the producer !
+            },
+            nullptr } },
+    };
+    return types;
+}
+
+void larg4::LArG4DetectorService::doFillEventWithArtHits(G4HCofThisEvent * myHC) {
+    static int const fillSlot = TimingRecorder::instance().slot("LArG4Detector/doFillEventWithArtHits");
+    ScopedTimer fillTimer(fillSlot);
+    // -- the detectors are finalized and their products built independently
+    //    (in parallel if enabled); only the puts are serialized
+    auto harvest = [](Harvester& h) {
+        ScopedTimer sdTimer(h.timerSlot);
+        h.type->harvest(h.sd, h.products, h.instance);
+    };
+    if (parallelHarvest_ && harvesters_.size() > 1) {
+        tbb::parallel_for(size_t(0), harvesters_.size(), [&](size_t i) { harvest(harvesters_[i]); });
+    } else {
+        for (auto& h : harvesters_) harvest(h);
+    }
+    art::ServiceHandle<artg4tk::DetectorHolderService> detectorHolder;
+    art::Event & e = detectorHolder -> getCurrArtEvent();
+    for (auto& h : harvesters_) {
+        for (auto& [instance, product] : h.products) product->putOrStash(*this, e, instance);
+        h.products.clear();
+        // -- logged here, out of the parallel tasks
+        if (auto sedsd = dynamic_cast<SimEnergyDepositSD const*>(h.sd)) sedsd->LogCoalescing();
+    }
+    // -- last sub-event: put everything accumulated for the art event
+    if (lastSubEvent_ && !pendingProducts_.empty()) {
+        reindexTimeWindowedHits();
+        for (auto& [key, pending] : pendingProducts_) {
+            pending->put(e, key.second);
         }
+        pendingProducts_.clear();
     }
 }
 using larg4::LArG4DetectorService;
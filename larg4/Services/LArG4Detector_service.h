@@ -44,6 +44,9 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <memory>
+#include <typeindex>
 #include <unordered_map>
 #include "Geant4/G4LogicalVolume.hh"
 #include "Geant4/G4LogicalVolumeStore.hh"
@@ -52,8 +55,12 @@
 
 // Get the base class
 #include "artg4tk/Core/DetectorBase.hh"
+#include "larg4/Services/AuxDetChannelMap.h"
+#include "larg4/Services/ElectricFieldMap.h"
 
-namespace art { class ProducesCollector; }
+namespace art { class Event; class ProducesCollector; }
+class G4VSensitiveDetector;
+namespace CLHEP { class HepRandomEngine; }
 
 namespace larg4 {
 
@@ -61,22 +68,91 @@ namespace larg4 {
   private:
     std::string gdmlFileName_;              // name of the gdml file
     bool checkoverlaps_;                    // enable/disable check of overlaps
+    int overlapResolution_;                 // number of surface points sampled per volume in the overlap check
+    double overlapTolerance_;               // overlaps smaller than this are ignored, [mm]
+    std::string overlapReportFile_;         // where to write the overlap report (optional)
     std::vector<std::string> volumeNames_;  // list of volume names for which step limits should be set
     std::vector<float> stepLimits_;         // corresponding step limits to be set for each volume in the list of volumeNames, [mm]
     size_t inputVolumes_;                   // number of stepLimits to be set
     bool dumpMP_;                           // enable/disable dump of material properties
+    std::string geometryCacheDir_;          // where the geometry and its checks are cached (disabled if empty)
+    fhicl::ParameterSet sedConfig_;         // configuration of the SimEnergyDeposit sensitive detectors
+    fhicl::ParameterSet auxDetConfig_;      // configuration of the AuxDet sensitive detectors
+    bool parallelHarvest_;                  // finalize the sensitive detectors and build their products in parallel
+    fhicl::ParameterSet fieldMapFiles_;     // <volume name, field map file> of the volumes with a field map
+    std::map<std::string, std::shared_ptr<ElectricFieldMap const>> fieldMaps_; // electric field by volume name
+    std::shared_ptr<AuxDetChannelMap const> auxDetChannelMap_; // readout channels of the AuxDet detectors (optional)
 
 
     // A message logger for this action
     mf::LogInfo logInfo_;
 
-    std::vector< std::pair<std::string,std::string>>  DetectorList;
+    // -- products of the current event (or sub-event)
+    struct PendingProduct {
+      virtual ~PendingProduct() = default;
+      virtual void put(art::Event& e, std::string const& instance) = 0;
+      virtual void putOrStash(LArG4DetectorService& self, art::Event& e, std::string const& instance) = 0;
+    };
+    template <typename T> struct PendingProductOf;
+    using Products = std::vector<std::pair<std::string, std::unique_ptr<PendingProduct>>>; // <instance, product>
+    template <typename T>
+    static void addProduct(Products& products, std::unique_ptr<T>&& product, std::string const& instance = "");
+
+    // -- a type of sensitive detector ("SensDet" auxiliary value in the GDML
+    //    file): how to build one, what it produces and how to build the
+    //    products from its hits. The known types are listed in sdTypes().
+    //    `harvest` only touches its own detector: it may run in parallel,
+    //    unless the detector draws from a shared random engine.
+    struct SDType {
+      G4VSensitiveDetector* (*make)(LArG4DetectorService&, G4String const& name);
+      void (*produces)(G4VSensitiveDetector*, art::ProducesCollector&, std::string const& instance);
+      void (*harvest)(G4VSensitiveDetector*, Products&, std::string const& instance);
+      void (*setTrackIDOffset)(G4VSensitiveDetector*, int); // nullptr: hits carry no track ID
+    };
+    static std::map<std::string, SDType> const& sdTypes();
+
+    // -- the sensitive detectors of the geometry, resolved once in doBuildLVs
+    struct Harvester {
+      G4VSensitiveDetector* sd;
+      SDType const* type;
+      std::string instance;   // product instance name
+      int timerSlot;          // timing of the harvest
+      Products products;      // built by the harvest, put in the event afterwards
+    };
+    std::vector<Harvester> harvesters_;
     std::map<std::string, G4double>                   overrideGDMLStepLimit_Map;
     std::unordered_map<std::string, float>            setGDMLVolumes_;         // holds all <volume, steplimit> pairs set from the GDML file
+
+    // -- sub-event bookkeeping: when one art event is simulated as several
+    //    Geant4 events, hits are accumulated here and put with the last one
+    bool firstSubEvent_;
+    bool lastSubEvent_;
+    std::map<std::pair<std::type_index, std::string>, std::unique_ptr<PendingProduct>> pendingProducts_;
   public:
     LArG4DetectorService(fhicl::ParameterSet const&);
     ~LArG4DetectorService();
 
+    // Declare where the current Geant4 event sits in the art event and the
+    // offset to add to the Geant4 track IDs stored in larg4 hits.
+    void setSubEvent(bool first, bool last, int trackIDOffset);
+
+    // Engine of the fluctuations of the analytic scintillation yield of the
+    // SimEnergyDeposit detectors; only needed if usesRandomEngine()
+    bool usesRandomEngine() const;
+    void setRandomEngine(CLHEP::HepRandomEngine* engine);
+
+    // Sensitive detectors whose hits keep the Geant4 track IDs of their own
+    // Geant4 event (the artg4tk ones): they cannot be used with sub-events
+    std::vector<std::string> sdsWithoutTrackIDOffset() const;
+
+    // Electric field of a logical volume (GDML Efield or ElectricFieldMaps
+    // file), nullptr if none
+    std::shared_ptr<ElectricFieldMap const> electricFieldMap(std::string const& volume) const;
+
+    // Readout channels of the AuxDet detectors, nullptr unless their
+    // AuxDetSD.channels is "channelMap"
+    std::shared_ptr<AuxDetChannelMap const> auxDetChannelMap() const { return auxDetChannelMap_; }
+
   private:
 
     // Private overriden methods
@@ -86,6 +162,9 @@ namespace larg4 {
     // -- D.R. Set the step limits for specific volumes from the configuration file
     void setStepLimits();
 
+    // Check all the placed volumes for overlaps (or reuse the cached result)
+    void checkOverlaps(std::string const& gdmlFile);
+
     // We need to add something to the art event, so we need these two methods:
 
     // Tell Art what we'll produce
@@ -93,6 +172,18 @@ namespace larg4 {
 
     // Actually produce
     virtual void doFillEventWithArtHits(G4HCofThisEvent * hc) override;
+
+    // Put a product, or merge it with the ones of the previous sub-events
+    template <typename T>
+    void putOrStash(art::Event& e, std::unique_ptr<T>&& product, std::string const& instance = "");
+
+    // The product accumulated over the sub-events so far, nullptr if none
+    template <typename T>
+    T* pendingProduct(std::string const& instance);
+
+    // Sort and index again the time-windowed AuxDet hits of all the
+    // sub-events (each one's index only covers its own hits)
+    void reindexTimeWindowedHits();
   };
 }
 
@@ -0,0 +1,92 @@
+//=============================================================================
+// OverlapCheck.cc: overlap check of the placed volumes of a geometry
+//=============================================================================
+#include "larg4/Services/OverlapCheck.h"
+#include "larg4/Services/ContentHash.h"
+#include "larg4/Services/GeometryCache.h"
+
+#include "Geant4/G4LogicalVolume.hh"
+#include "Geant4/G4VPhysicalVolume.hh"
+#include "CLHEP/Units/SystemOfUnits.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+namespace larg4 {
+
+  std::string overlapReportHeader(int resolution, double tolerance)
+  {
+    std::ostringstream header;
+    header << "# overlap check: resolution " << resolution << " tolerance " << tolerance << " mm\n";
+    return header.str();
+  }
+
+  std::string overlapReportCacheFile(std::string const& cacheDir, std::string const& gdmlFile,
+                                     int resolution, double tolerance)
+  {
+    return cacheDir + "/"
+      + contentHash(overlapReportHeader(resolution, tolerance) + gdmlContent(gdmlFile)) + ".overlaps";
+  }
+
+  std::vector<std::string> findOverlaps(std::vector<G4VPhysicalVolume*> const& volumes,
+                                        size_t first, size_t stride,
+                                        int resolution, double tolerance)
+  {
+    std::vector<std::string> lines;
+    for (size_t i = first; i < volumes.size(); i += stride) {
+      G4VPhysicalVolume* pv = volumes[i];
+      if (!pv->GetMotherLogical()) continue; // world
+      if (pv->CheckOverlaps(resolution, tolerance * CLHEP::mm, false)) {
+        std::ostringstream line;
+        line << pv->GetName() << '\t' << pv->GetCopyNo() << '\t' << pv->GetMotherLogical()->GetName();
+        lines.push_back(line.str());
+      }
+    }
+    return lines;
+  }
+
+  std::string overlapReport(int resolution, double tolerance, std::vector<std::string> lines)
+  {
+    std::sort(lines.begin(), lines.end());
+    std::string report = overlapReportHeader(resolution, tolerance);
+    for (auto const& line: lines) report += line + '\n';
+    return report;
+  }
+
+  size_t overlapCount(std::string const& report)
+  {
+    size_t n = 0;
+    std::istringstream in(report);
+    for (std::string line; std::getline(in, line);) {
+      if (!line.empty() && line[0] != '#') ++n;
+    }
+    return n;
+  }
+
+  bool readOverlapReport(std::string const& file, std::string& report)
+  {
+    std::ifstream in(file);
+    if (!in) return false;
+    std::stringstream ss;
+    ss << in.rdbuf();
+    report = ss.str();
+    return true;
+  }
+
+  bool storeOverlapReport(std::string const& file, std::string const& report)
+  {
+    std::string const tmpFile = file + ".tmp" + std::to_string(getpid());
+    std::ofstream out(tmpFile);
+    out << report;
+    out.close();
+    if (!out || std::rename(tmpFile.c_str(), file.c_str()) != 0) {
+      std::remove(tmpFile.c_str());
+      return false;
+    }
+    return true;
+  }
+
+} // namespace larg4
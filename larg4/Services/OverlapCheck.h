@@ -0,0 +1,55 @@
+// OverlapCheck.h
+//
+// Overlap check of the placed volumes of a geometry, shared by
+// LArG4DetectorService (CheckOverlaps) and the larg4_check_overlaps tool.
+//
+// A report starts with a "#" line recording the settings of the check; each
+// further line is one overlapping placement, tab separated: volume name,
+// copy number and mother volume name. Lines are sorted, so a report does not
+// depend on the order in which the volumes were checked.
+//
+// Reports are cached in a directory, under the hash of the settings and of
+// the GDML files. The service only checks serially, inside the art process;
+// larg4_check_overlaps checks in parallel in a process of its own and fills
+// the same cache, which the service then reads.
+
+#ifndef LARG4_OVERLAPCHECK_H
+#define LARG4_OVERLAPCHECK_H
+
+#include <string>
+#include <vector>
+
+class G4VPhysicalVolume;
+
+namespace larg4 {
+
+  /// First line of a report: `resolution` surface points sampled per
+  /// volume, overlaps up to `tolerance` [mm] ignored
+  std::string overlapReportHeader(int resolution, double tolerance);
+
+  /// Cache file of the report of the geometry read from `gdmlFile`
+  std::string overlapReportCacheFile(std::string const& cacheDir, std::string const& gdmlFile,
+                                     int resolution, double tolerance);
+
+  /// Report lines of the overlapping placements among the volumes
+  /// first, first + stride, ... (unsorted)
+  std::vector<std::string> findOverlaps(std::vector<G4VPhysicalVolume*> const& volumes,
+                                        size_t first, size_t stride,
+                                        int resolution, double tolerance);
+
+  /// Report with the header and the sorted lines
+  std::string overlapReport(int resolution, double tolerance, std::vector<std::string> lines);
+
+  /// Number of overlapping placements of a report
+  size_t overlapCount(std::string const& report);
+
+  /// Reads a cached report; false if there is none
+  bool readOverlapReport(std::string const& file, std::string& report);
+
+  /// Writes a report aside and renames it into place, so that concurrent
+  /// jobs never read half a report; false on failure
+  bool storeOverlapReport(std::string const& file, std::string const& report);
+
+} // namespace larg4
+
+#endif // LARG4_OVERLAPCHECK_H
@@ -0,0 +1,118 @@
+// ProcessRegistry.h
+//
+// Properties of the Geant4 processes that larg4 tests on every step,
+// precomputed once from the process names so that the hot paths (sensitive
+// detectors, stepping and tracking actions) look them up by process pointer
+// instead of comparing strings.
+//
+// larg4Main builds the registry after the run manager is initialized, when
+// all the processes are attached to the particles. A process that is not in
+// the registry is classified from its name on the spot (same answer, slower).
+
+#ifndef LARG4_PROCESSREGISTRY_H
+#define LARG4_PROCESSREGISTRY_H
+
+#include "Geant4/G4ParticleDefinition.hh"
+#include "Geant4/G4ParticleTable.hh"
+#include "Geant4/G4ProcessManager.hh"
+#include "Geant4/G4ProcessVector.hh"
+#include "Geant4/G4Scintillation.hh"
+#include "Geant4/G4VProcess.hh"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace larg4 {
+
+  class ProcessRegistry {
+  public:
+    struct Flags {
+      bool scintillation = false;   ///< the "Scintillation" process
+      bool ignoredForTrajectories = false; ///< voxel/readout process: no trajectory point
+      int notStoredIndex = -1;      ///< first matching NotStoredPhysics entry (-1: none)
+    };
+
+    static ProcessRegistry& instance()
+    {
+      static ProcessRegistry registry;
+      return registry;
+    }
+
+    /// Classifies all the processes attached to the known particles.
+    /// `notStoredPhysics` are the (partial) names of the processes whose
+    /// products ParticleListActionService does not store.
+    void build(std::vector<std::string> const& notStoredPhysics)
+    {
+      notStoredPhysics_ = notStoredPhysics;
+      flags_.clear();
+      scintillation_.clear();
+      auto* particleIterator = G4ParticleTable::GetParticleTable()->GetIterator();
+      particleIterator->reset();
+      while ((*particleIterator)()) {
+        G4ParticleDefinition const* particle = particleIterator->value();
+        G4ProcessManager const* processManager = particle->GetProcessManager();
+        if (!processManager) continue;
+        G4ProcessVector const* processes = processManager->GetProcessList();
+        G4int const nProcesses = processes->size();
+        for (G4int i = 0; i < nProcesses; ++i) {
+          G4VProcess* process = (*processes)[i];
+          Flags const f = classify(process->GetProcessName());
+          flags_.emplace(process, f);
+          if (f.scintillation) {
+            if (auto* scintillation = dynamic_cast<G4Scintillation*>(process))
+              scintillation_[particle].push_back(scintillation);
+          }
+        }
+      }
+      built_ = true;
+    }
+
+    /// Flags of the process (nullptr: no process, no flag)
+    Flags flags(G4VProcess const* process) const
+    {
+      if (!process) return {};
+      auto const it = flags_.find(process);
+      return (it != flags_.end()) ? it->second : classify(process->GetProcessName());
+    }
+
+    /// Scintillation processes attached to a particle. Only available once
+    /// built: returns nullptr before, and callers fall back to a name search.
+    std::vector<G4Scintillation*> const* scintillationProcesses(G4ParticleDefinition const* particle) const
+    {
+      if (!built_) return nullptr;
+      auto const it = scintillation_.find(particle);
+      return (it != scintillation_.end()) ? &(it->second) : &noScintillation_;
+    }
+
+    bool built() const { return built_; }
+    std::vector<std::string> const& notStoredPhysics() const { return notStoredPhysics_; }
+
+  private:
+    ProcessRegistry() = default;
+
+    Flags classify(std::string const& name) const
+    {
+      Flags f;
+      f.scintillation = (name == "Scintillation");
+      f.ignoredForTrajectories = (name.find("LArVoxel") != std::string::npos)
+                              || (name.find("OpDetReadout") != std::string::npos);
+      for (size_t i = 0; i < notStoredPhysics_.size(); ++i) {
+        if (name.find(notStoredPhysics_[i]) != std::string::npos) {
+          f.notStoredIndex = i;
+          break;
+        }
+      }
+      return f;
+    }
+
+    bool built_ = false;
+    std::vector<std::string> notStoredPhysics_;
+    std::unordered_map<G4VProcess const*, Flags> flags_;
+    std::unordered_map<G4ParticleDefinition const*, std::vector<G4Scintillation*>> scintillation_;
+    std::vector<G4Scintillation*> const noScintillation_;
+  };
+
+} // namespace larg4
+
+#endif // LARG4_PROCESSREGISTRY_H
@@ -13,6 +13,8 @@
 // Author: Hans Wenzel (Fermilab)
 //=============================================================================
 #include "larg4/Services/SimEnergyDepositSD.h"
+#include "larg4/Services/TimingRecorder.h"
+#include "larg4/Services/ProcessRegistry.h"
 #include "Geant4/G4HCofThisEvent.hh"
 #include "Geant4/G4Step.hh"
 #include "Geant4/G4ThreeVector.hh"
@@ -25,13 +27,115 @@
 #include "Geant4/G4Cerenkov.hh"
 #include "Geant4/G4Scintillation.hh"
 #include "Geant4/G4SteppingManager.hh"
+#include "cetlib_except/exception.h"
+#include "messagefacility/MessageLogger/MessageLogger.h"
+#include "CLHEP/Random/RandGaussQ.h"
+#include "CLHEP/Random/RandPoissonQ.h"
+
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
 namespace larg4 {
 
-  SimEnergyDepositSD::SimEnergyDepositSD(G4String name)
-: G4VSensitiveDetector(name) {
+  SimEnergyDepositSD::SimEnergyDepositSD(G4String name, fhicl::ParameterSet const& config)
+: G4VSensitiveDetector(name)
+, processHitsSlot(TimingRecorder::instance().slot("SD/" + name + "/ProcessHits"))
+, coalescing(kNone)
+, maxLength(config.get<double>("maxLength", 0.3) * CLHEP::cm)
+, maxTime(config.get<double>("maxTime", 1.) * CLHEP::ns)
+, voxelSize(config.get<double>("voxelSize", 0.3) * CLHEP::cm)
+, segmentLength(config.get<double>("segmentLength", 0.) * CLHEP::cm)
+, segmentRule(kDEdx)
+, yieldModel(kGeant4)
+, electricField(config.get<double>("electricField", 0.5))
+, density(config.get<double>("density", 1.396))
+, yieldA(0.)
+, yieldB(0.)
+, yieldP(0.)
+, birksA(0.)
+, birksK(0.)
+, modBoxMindEdx(0.)
+, excitationRatio(0.)
+, analyticScintillation(false)
+, photonYield()
+, photonFluctuation(kNoFluctuation)
+, fanoFactor(config.get<double>("fanoFactor", 1.)) {
    hitCollection.clear();
+   std::string const mode = config.get<std::string>("coalescing", "none");
+   if (mode == "track") coalescing = kTrack;
+   else if (mode == "voxel") coalescing = kVoxel;
+   else if (mode != "none") {
+     throw cet::exception("SimEnergyDepositSD") << "Unknown coalescing mode: " << mode
+                                                << " (expected none, track or voxel)\n";
+   }
+   if (coalescing == kVoxel && voxelSize <= 0.) {
+     throw cet::exception("SimEnergyDepositSD") << "voxelSize must be positive\n";
+   }
+   // -- track coalescing must not merge segments back beyond segmentLength
+   if (coalescing == kTrack && segmentLength > 0. && maxLength > segmentLength) {
+     MF_LOG_DEBUG("SimEnergyDepositSD") << "maxLength capped at segmentLength ("
+                                        << segmentLength / CLHEP::cm << " cm)";
+     maxLength = segmentLength;
+   }
+   std::string const rule = config.get<std::string>("segmentRule", "dEdx");
+   if (rule == "uniform") segmentRule = kUniform;
+   else if (rule != "dEdx") {
+     throw cet::exception("SimEnergyDepositSD") << "Unknown segment rule: " << rule
+                                                << " (expected uniform or dEdx)\n";
+   }
+   std::string const model = config.get<std::string>("yieldModel", "Geant4");
+   if (model == "Birks") {
+     yieldModel = kBirks;
+     auto const birks = config.get<fhicl::ParameterSet>("Birks", fhicl::ParameterSet());
+     yieldA = birks.get<double>("A", 0.800);
+     yieldB = birks.get<double>("k", 0.0486);
+   }
+   else if (model == "ModBox") {
+     yieldModel = kModBox;
+     auto const modbox = config.get<fhicl::ParameterSet>("ModBox", fhicl::ParameterSet());
+     yieldA = modbox.get<double>("A", 0.930);
+     yieldB = modbox.get<double>("B", 0.212);
+     modBoxMindEdx = modbox.get<double>("mindEdx", 1.5);
+     auto const birks = config.get<fhicl::ParameterSet>("Birks", fhicl::ParameterSet());
+     birksA = birks.get<double>("A", 0.800);
+     birksK = birks.get<double>("k", 0.0486);
+   }
+   else if (model == "NEST") {
+     yieldModel = kNEST;
+     auto const nest = config.get<fhicl::ParameterSet>("NEST", fhicl::ParameterSet());
+     excitationRatio = nest.get<double>("excitationRatio", 0.21);
+     yieldB = nest.get<double>("C", 0.25);
+     yieldP = nest.get<double>("p", 0.85);
+   }
+   else if (model != "Geant4") {
+     throw cet::exception("SimEnergyDepositSD") << "Unknown yield model: " << model
+                                                << " (expected Geant4, Birks, ModBox or NEST)\n";
+   }
+   std::string const scintillation = config.get<std::string>("scintillation", "Geant4");
+   if (scintillation == "Analytic") analyticScintillation = true;
+   else if (scintillation != "Geant4") {
+     throw cet::exception("SimEnergyDepositSD") << "Unknown scintillation mode: " << scintillation
+                                                << " (expected Geant4 or Analytic)\n";
+   }
+   // -- default yields: LAr at zero field, quenched by particle type
+   auto const yields = config.get<fhicl::ParameterSet>("photonYield", fhicl::ParameterSet());
+   photonYield[kOther] = yields.get<double>("default", 24000.);
+   photonYield[kElectron] = yields.get<double>("electron", 20000.);
+   photonYield[kMuon] = yields.get<double>("muon", 24000.);
+   photonYield[kPion] = yields.get<double>("pion", 24000.);
+   photonYield[kKaon] = yields.get<double>("kaon", 24000.);
+   photonYield[kProton] = yields.get<double>("proton", 19200.);
+   photonYield[kAlpha] = yields.get<double>("alpha", 16800.);
+   photonYield[kIon] = yields.get<double>("ion", 16800.);
+   std::string const fluctuation = config.get<std::string>("photonFluctuation", "none");
+   if (fluctuation == "Poisson") photonFluctuation = kPoisson;
+   else if (fluctuation == "Fano") photonFluctuation = kFano;
+   else if (fluctuation != "none") {
+     throw cet::exception("SimEnergyDepositSD") << "Unknown photon fluctuation: " << fluctuation
+                                                << " (expected none, Poisson or Fano)\n";
+   }
 }
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -44,10 +148,51 @@ namespace larg4 {
 
   void   SimEnergyDepositSD::Initialize(G4HCofThisEvent* HCE) {
     hitCollection.clear();
+    open = false;
+    voxels.clear();
+    voxelIndex.clear();
+    nSteps = 0;
+    nDeposits = 0;
+    finalized = false;
+    buffers.clear();
+    buffers.reserve(expectedDeposits + expectedDeposits / 4);
+    timeSteps = TimingRecorder::instance().level() >= TimingRecorder::kStep;
+  }
+
+  //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+  void SimEnergyDepositSD::EndOfEvent(G4HCofThisEvent*) {
+    if (!deferFinalization) FinalizeEvent();
+  }
+
+  //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+  void SimEnergyDepositSD::FinalizeEvent() {
+    if (finalized) return;
+    finalized = true;
+    flush();
+    // -- the expected size follows a larger event at once and a smaller one
+    //    slowly; after an exceptionally large event the memory is given back
+    expectedDeposits = std::max(buffers.size(), expectedDeposits - expectedDeposits / 8);
+    if (yieldModel != kGeant4) applyYieldModel();
+    if (analyticScintillation) applyPhotonYield();
+    convertBuffers();
+    nDeposits = hitCollection.size();
+    if (buffers.capacity() > 4 * expectedDeposits + 1024) buffers.release(expectedDeposits);
+  }
+
+  void SimEnergyDepositSD::LogCoalescing() const {
+    if ((coalescing != kNone || segmentLength > 0.) && nDeposits > 0) {
+      MF_LOG_DEBUG("SimEnergyDepositSD") << GetName() << ": " << nSteps << " steps stored as "
+                                         << nDeposits << " deposits (ratio "
+                                         << double(nSteps) / nDeposits << ")";
+    }
   }
   //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
 
   G4bool   SimEnergyDepositSD::ProcessHits(G4Step* aStep, G4TouchableHistory*) {
+       // -- without per-step timing the timer reads neither the level nor the clock
+       ScopedTimer timer(timeSteps ? processHitsSlot : -1, TimingRecorder::kStep);
        G4double edep = aStep->GetTotalEnergyDeposit()/CLHEP::MeV;
 
        if (edep == 0.) return false;
@@ -56,44 +201,357 @@ namespace larg4 {
        int nrelec=(int)round(edep*electronsperMeV);
        if (aStep->GetTrack()->GetDynamicParticle()->GetCharge() == 0) return false;
        G4int photons = 0;
-       G4SteppingManager* fpSteppingManager = G4EventManager::GetEventManager()
-         ->GetTrackingManager()->GetSteppingManager();
-       G4StepStatus stepStatus = fpSteppingManager->GetfStepStatus();
-       if (stepStatus != fAtRestDoItProc) {
-         G4ProcessVector* procPost = fpSteppingManager->GetfPostStepDoItVector();
-         size_t MAXofPostStepLoops = fpSteppingManager->GetMAXofPostStepLoops();
-         for (size_t i3 = 0; i3 < MAXofPostStepLoops; i3++) {
-           /*
-             if ((*procPost)[i3]->GetProcessName() == "Cerenkov") {
-             G4Cerenkov* proc =(G4Cerenkov*) (*procPost)[i3];
-             photons+=proc->GetNumPhotons();
+       // -- with a yield model the counts are computed at the end of the
+       //    event; the stepping manager is looked up for Geant4 counts only
+       if ((yieldModel == kGeant4) && !analyticScintillation) {
+         G4SteppingManager* fpSteppingManager = G4EventManager::GetEventManager()
+           ->GetTrackingManager()->GetSteppingManager();
+         if (fpSteppingManager->GetfStepStatus() != fAtRestDoItProc) {
+           // -- the scintillation processes of this particle, looked up once
+           auto const* scintillation = ProcessRegistry::instance()
+             .scintillationProcesses(aStep->GetTrack()->GetParticleDefinition());
+           if (scintillation) {
+             for (G4Scintillation* proc1: *scintillation) photons += proc1->GetNumPhotons();
+           }
+           else {
+             G4ProcessVector* procPost = fpSteppingManager->GetfPostStepDoItVector();
+             size_t MAXofPostStepLoops = fpSteppingManager->GetMAXofPostStepLoops();
+             for (size_t i3 = 0; i3 < MAXofPostStepLoops; i3++) {
+               /*
+                 if ((*procPost)[i3]->GetProcessName() == "Cerenkov") {
+                 G4Cerenkov* proc =(G4Cerenkov*) (*procPost)[i3];
+                 photons+=proc->GetNumPhotons();
+                 }
+               */
+               if ((*procPost)[i3]->GetProcessName() == "Scintillation") {
+                 G4Scintillation* proc1 = (G4Scintillation*) (*procPost)[i3];
+                 photons += proc1->GetNumPhotons();
+               }
              }
-           */
-           if ((*procPost)[i3]->GetProcessName() == "Scintillation") {
-             G4Scintillation* proc1 = (G4Scintillation*) (*procPost)[i3];
-             photons += proc1->GetNumPhotons();
            }
          }
        }
-       geo::Point_t start = geo::Point_t(
-                                         aStep->GetPreStepPoint()->GetPosition().x()/CLHEP::cm,
-                                         aStep->GetPreStepPoint()->GetPosition().y()/CLHEP::cm,
-                                         aStep->GetPreStepPoint()->GetPosition().z()/CLHEP::cm);
-       geo::Point_t end = geo::Point_t(
-                                       aStep->GetPostStepPoint()->GetPosition().x()/CLHEP::cm,
-                                       aStep->GetPostStepPoint()->GetPosition().y()/CLHEP::cm,
-                                       aStep->GetPostStepPoint()->GetPosition().z()/CLHEP::cm);
-       sim::SimEnergyDeposit  newHit =  sim::SimEnergyDeposit(photons,
-                                                              nrelec,
-                                                              1.0,
-                                                              edep,
-                                                              start,
-                                                              end,
-                                                              aStep->GetPreStepPoint()->GetGlobalTime() / CLHEP::ns,
-                                                              aStep->GetPostStepPoint()->GetGlobalTime() /CLHEP::ns,
-                                                              aStep->GetTrack()->GetTrackID(),
-                                                              aStep->GetTrack()->GetParticleDefinition()->GetPDGEncoding()  );
-       hitCollection.push_back(newHit);
+       // -- Geant4 units: converted at the end of the event
+       G4StepPoint const* pre = aStep->GetPreStepPoint();
+       G4StepPoint const* post = aStep->GetPostStepPoint();
+       Deposit const step{pre->GetPosition(),
+                          post->GetPosition(),
+                          pre->GetGlobalTime(),
+                          post->GetGlobalTime(),
+                          edep,
+                          nrelec,
+                          photons,
+                          aStep->GetTrack()->GetTrackID() + trackIDOffset,
+                          aStep->GetTrack()->GetParticleDefinition()->GetPDGEncoding()};
+       ++nSteps;
+       if (segmentLength > 0.) addSegments(step, aStep);
+       else addDeposit(step);
     return true;
   }// end ProcessHits
+
+  //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+  void SimEnergyDepositSD::addDeposit(Deposit const& step) {
+    switch (coalescing) {
+    case kNone:
+      buffers.push_back(step);
+      break;
+    case kTrack: {
+      // -- merge only steps that continue the open deposit: same track,
+      //    starting where the deposit ends, and within the tolerances
+      bool const continues = open
+        && step.trackID == current.trackID
+        && (step.start - current.end).mag() < 1e-5 * CLHEP::mm
+        && (step.end - current.start).mag() <= maxLength
+        && step.endT - current.startT <= maxTime;
+      if (continues) {
+        merge(current, step);
+      } else {
+        if (open) buffers.push_back(current);
+        current = step;
+        open = true;
+      }
+      break;
+    }
+    case kVoxel: {
+      VoxelKey const key{std::lround(std::floor(0.5 * (step.start.x() + step.end.x()) / voxelSize)),
+                         std::lround(std::floor(0.5 * (step.start.y() + step.end.y()) / voxelSize)),
+                         std::lround(std::floor(0.5 * (step.start.z() + step.end.z()) / voxelSize)),
+                         step.trackID};
+      auto const [it, inserted] = voxelIndex.try_emplace(key, voxels.size());
+      if (inserted) voxels.push_back(step);
+      else merge(voxels[it->second], step);
+      break;
+    }
+    }
+  }
+
+  //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+  void SimEnergyDepositSD::addSegments(Deposit const& step, G4Step const* aStep) {
+    int const n = static_cast<int>(std::ceil((step.end - step.start).mag() / segmentLength));
+    if (n <= 1) {
+      addDeposit(step);
+      return;
+    }
+
+    // -- weight of each segment: its (equal) length, times the stopping power
+    //    at its middle for the "dEdx" rule
+    double dedxPre = 1.;
+    double dedxPost = 1.;
+    if (segmentRule == kDEdx) {
+      G4StepPoint const* pre = aStep->GetPreStepPoint();
+      G4StepPoint const* post = aStep->GetPostStepPoint();
+      G4ParticleDefinition const* particle = aStep->GetTrack()->GetParticleDefinition();
+      // -- a stopping particle: take the stopping power just before it stops
+      double const minEnergy = 1. * CLHEP::keV;
+      double const a = emCalculator.GetDEDX(std::max(pre->GetKineticEnergy(), minEnergy),
+                                            particle, pre->GetMaterial());
+      double const b = emCalculator.GetDEDX(std::max(post->GetKineticEnergy(), minEnergy),
+                                            particle, pre->GetMaterial());
+      if (a > 0. && b > 0.) { // -- otherwise no table for this particle: uniform
+        dedxPre = a;
+        dedxPost = b;
+      }
+    }
+    segmentShare.resize(n);
+    double sum = 0.;
+    for (int i = 0; i < n; ++i) {
+      sum += dedxPre + (dedxPost - dedxPre) * (i + 0.5) / n;
+      segmentShare[i] = sum;
+    }
+    for (int i = 0; i < n; ++i) segmentShare[i] /= sum;
+    segmentShare[n - 1] = 1.;
+
+    // -- electrons and photons are shared by rounding the cumulative counts,
+    //    so that the segments add up exactly to the step
+    auto const delta = step.end - step.start;
+    double previousShare = 0.;
+    Deposit segment = step;
+    for (int i = 0; i < n; ++i) {
+      double const share = segmentShare[i];
+      segment.start = step.start + delta * (double(i) / n);
+      segment.end = (i == n - 1) ? step.end : step.start + delta * (double(i + 1) / n);
+      segment.startT = step.startT + (step.endT - step.startT) * i / n;
+      segment.endT = (i == n - 1) ? step.endT : step.startT + (step.endT - step.startT) * (i + 1) / n;
+      segment.edep = step.edep * (share - previousShare);
+      segment.nElectrons = std::lround(step.nElectrons * share) - std::lround(step.nElectrons * previousShare);
+      segment.nPhotons = std::lround(step.nPhotons * share) - std::lround(step.nPhotons * previousShare);
+      addDeposit(segment);
+      previousShare = share;
+    }
+  }
+
+  //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+  // the merged deposit spans from the start of its earliest step to the end
+  // of its latest one
+  void SimEnergyDepositSD::merge(Deposit& into, Deposit const& step) {
+    if (step.startT < into.startT) {
+      into.start = step.start;
+      into.startT = step.startT;
+    }
+    if (step.endT >= into.endT) {
+      into.end = step.end;
+      into.endT = step.endT;
+    }
+    into.edep += step.edep;
+    into.nElectrons += step.nElectrons;
+    into.nPhotons += step.nPhotons;
+  }
+
+  //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+  void SimEnergyDepositSD::flush() {
+    if (open) {
+      buffers.push_back(current);
+      open = false;
+    }
+    buffers.reserve(buffers.size() + voxels.size());
+    for (auto const& voxel: voxels) buffers.push_back(voxel);
+    voxels.clear();
+    voxelIndex.clear();
+  }
+
+  //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+  void SimEnergyDepositSD::applyYieldModel() {
+    double const wIon = 23.6e-6;   // [MeV] per electron-ion pair
+    double const wQuanta = 19.5e-6; // [MeV] per quantum (ion or exciton)
+    double const maxdEdx = 1000.;   // [MeV/cm] for deposits without length
+    size_t const n = buffers.size();
+
+    // -- field at the middle of each deposit, looked up in one batch
+    bool const uniform = !fieldMap || fieldMap->uniform();
+    fields.assign(n, fieldMap ? std::abs(fieldMap->at(0., 0., 0.).x) : electricField);
+    if (!uniform) {
+      midX.resize(n);
+      midY.resize(n);
+      midZ.resize(n);
+      for (size_t i = 0; i < n; ++i) {
+        midX[i] = 0.5 * (buffers.x0[i] + buffers.x1[i]) / CLHEP::cm;
+        midY[i] = 0.5 * (buffers.y0[i] + buffers.y1[i]) / CLHEP::cm;
+        midZ[i] = 0.5 * (buffers.z0[i] + buffers.z1[i]) / CLHEP::cm;
+      }
+      fieldMap->magnitudes(n, midX.data(), midY.data(), midZ.data(), fields.data());
+    }
+
+    // -- one loop per model, over the arrays: R is the fraction of the
+    //    ionization electrons escaping recombination
+    auto fill = [&](auto escaping, bool nestQuanta) {
+      for (size_t i = 0; i < n; ++i) {
+        double const dx = buffers.x1[i] - buffers.x0[i];
+        double const dy = buffers.y1[i] - buffers.y0[i];
+        double const dz = buffers.z1[i] - buffers.z0[i];
+        double const length = std::sqrt(dx * dx + dy * dy + dz * dz) / CLHEP::cm;
+        double const edep = buffers.edep[i] / CLHEP::MeV;
+        double const dEdx = (length > 0.) ? std::min(edep / length, maxdEdx) : maxdEdx;
+        double const field = fields[i];
+        double const R = (field > 0.) ? std::clamp(escaping(dEdx, field), 0., 1.) : 0.;
+        if (nestQuanta) {
+          double const nQuanta = edep / wQuanta;
+          double const nIons = nQuanta / (1. + excitationRatio);
+          buffers.nElectrons[i] = std::lround(nIons * R);
+          buffers.nPhotons[i] = std::lround(nQuanta - nIons * R);
+        } else {
+          long const electrons = std::lround(edep / wIon * R);
+          buffers.nElectrons[i] = electrons;
+          buffers.nPhotons[i] = std::max(0L, std::lround(edep / wQuanta) - electrons);
+        }
+      }
+    };
+    switch (yieldModel) {
+    case kBirks:
+      fill([this](double dEdx, double field) { return yieldA / (1. + yieldB * dEdx / (density * field)); }, false);
+      break;
+    case kModBox:
+      fill([this](double dEdx, double field) {
+          // -- Birks below the range of validity of ModBox
+          double const xi = yieldB * dEdx / (density * field);
+          if (dEdx < modBoxMindEdx || yieldA + xi <= 1.) {
+            return birksA / (1. + birksK * dEdx / (density * field));
+          }
+          return std::log(yieldA + xi) / xi;
+        }, false);
+      break;
+    case kNEST:
+      fill([this](double dEdx, double field) {
+          double const xi = yieldB * dEdx * std::pow(field, -yieldP);
+          return (xi > 0.) ? std::log1p(xi) / xi : 1.;
+        }, true);
+      break;
+    case kGeant4:
+      break;
+    }
+  }
+
+  //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+  void SimEnergyDepositSD::applyPhotonYield() {
+    if (photonFluctuation != kNoFluctuation && !randomEngine) {
+      throw cet::exception("SimEnergyDepositSD") << "photonFluctuation needs a random engine"
+                                                 << " (larg4Main ScintEngine)\n";
+    }
+    auto particleClass = [](int pdg) {
+      switch (std::abs(pdg)) {
+      case 11: return kElectron;
+      case 13: return kMuon;
+      case 211: return kPion;
+      case 321: return kKaon;
+      case 2212: return kProton;
+      case 1000020040: return kAlpha;
+      default: return (std::abs(pdg) > 1000000000) ? kIon : kOther;
+      }
+    };
+    size_t const n = buffers.size();
+    for (size_t i = 0; i < n; ++i) {
+      double const mean = photonYield[particleClass(buffers.pdg[i])] * buffers.edep[i] / CLHEP::MeV;
+      switch (photonFluctuation) {
+      case kNoFluctuation:
+        buffers.nPhotons[i] = std::lround(mean);
+        break;
+      case kPoisson:
+        buffers.nPhotons[i] = CLHEP::RandPoissonQ::shoot(randomEngine, mean);
+        break;
+      case kFano:
+        buffers.nPhotons[i] = std::max(0L, std::lround(CLHEP::RandGaussQ::shoot(randomEngine, mean,
+                                                                                  std::sqrt(fanoFactor * mean))));
+        break;
+      }
+    }
+  }
+
+  //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+  void SimEnergyDepositSD::convertBuffers() {
+    // -- units first, one array at a time (vectorized loops)
+    for (std::vector<double>* v: {&buffers.x0, &buffers.y0, &buffers.z0,
+                                  &buffers.x1, &buffers.y1, &buffers.z1}) {
+      for (double& x: *v) x /= CLHEP::cm;
+    }
+    for (std::vector<double>* v: {&buffers.t0, &buffers.t1}) {
+      for (double& t: *v) t /= CLHEP::ns;
+    }
+    for (double& e: buffers.edep) e /= CLHEP::MeV;
+
+    size_t const n = buffers.size();
+    hitCollection.clear();
+    hitCollection.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+      hitCollection.emplace_back(buffers.nPhotons[i],
+                                 buffers.nElectrons[i],
+                                 1.0,
+                                 buffers.edep[i],
+                                 geo::Point_t{buffers.x0[i], buffers.y0[i], buffers.z0[i]},
+                                 geo::Point_t{buffers.x1[i], buffers.y1[i], buffers.z1[i]},
+                                 buffers.t0[i],
+                                 buffers.t1[i],
+                                 buffers.trackID[i],
+                                 buffers.pdg[i]);
+    }
+    buffers.clear();
+  }
+
+  //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+  void SimEnergyDepositSD::DepositBuffers::push_back(Deposit const& d) {
+    x0.push_back(d.start.x());
+    y0.push_back(d.start.y());
+    z0.push_back(d.start.z());
+    x1.push_back(d.end.x());
+    y1.push_back(d.end.y());
+    z1.push_back(d.end.z());
+    t0.push_back(d.startT);
+    t1.push_back(d.endT);
+    edep.push_back(d.edep);
+    nElectrons.push_back(d.nElectrons);
+    nPhotons.push_back(d.nPhotons);
+    trackID.push_back(d.trackID);
+    pdg.push_back(d.pdg);
+  }
+
+  void SimEnergyDepositSD::DepositBuffers::clear() {
+    for (auto* v: {&x0, &y0, &z0, &x1, &y1, &z1, &t0, &t1, &edep}) v->clear();
+    for (auto* v: {&nElectrons, &nPhotons, &trackID, &pdg}) v->clear();
+  }
+
+  void SimEnergyDepositSD::DepositBuffers::reserve(size_t n) {
+    for (auto* v: {&x0, &y0, &z0, &x1, &y1, &z1, &t0, &t1, &edep}) v->reserve(n);
+    for (auto* v: {&nElectrons, &nPhotons, &trackID, &pdg}) v->reserve(n);
+  }
+
+  void SimEnergyDepositSD::DepositBuffers::release(size_t n) {
+    for (auto* v: {&x0, &y0, &z0, &x1, &y1, &z1, &t0, &t1, &edep}) {
+      std::vector<double> smaller;
+      smaller.reserve(std::max(n, v->size()));
+      smaller.assign(v->begin(), v->end());
+      v->swap(smaller);
+    }
+    for (auto* v: {&nElectrons, &nPhotons, &trackID, &pdg}) {
+      std::vector<int> smaller;
+      smaller.reserve(std::max(n, v->size()));
+      smaller.assign(v->begin(), v->end());
+      v->swap(smaller);
+    }
+  }
 } // end namespace  larg4
@@ -17,24 +17,195 @@
 //=============================================================================
 
 #include "Geant4/G4VSensitiveDetector.hh"
+#include "Geant4/G4EmCalculator.hh"
+#include "Geant4/G4ThreeVector.hh"
 #include "lardataobj/Simulation/SimEnergyDeposit.h"
+#include "fhiclcpp/ParameterSet.h"
+#include "larg4/Services/ElectricFieldMap.h"
+
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 class G4Step;
 class G4HCofThisEvent;
+namespace CLHEP { class HepRandomEngine; }
 //class SimEnergyDepositCollection;
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
 namespace larg4 {
 
+    // Steps can be coalesced into fewer deposits (parameter `coalescing`):
+    //  "none"  : one deposit per step (default)
+    //  "track" : consecutive steps of a track are merged while the deposit
+    //            stays shorter than `maxLength` [cm] and `maxTime` [ns]
+    //  "voxel" : steps are merged by track in a sparse grid of cubic voxels
+    //            of side `voxelSize` [cm], by the voxel of their midpoint
+    // Energy, electrons and photons of the merged steps are summed.
+    //
+    // Independently of the Geant4 step limit, steps longer than
+    // `segmentLength` [cm] (0: disabled) are split into equal segments no
+    // longer than that, sharing the energy, electrons and photons of the step
+    // by `segmentRule`:
+    //  "uniform" : in proportion to the segment length
+    //  "dEdx"    : in proportion to the stopping power, interpolated along the
+    //              step between its values at the pre- and post-step kinetic
+    //              energies (default)
+    // Segments are coalesced like steps. With "track", `maxLength` is capped
+    // at `segmentLength`, so that merging never gives back deposits longer
+    // than the segments asked for (the segments of one step are never merged
+    // together); with "voxel", segments in the same voxel are merged.
+    //
+    // Steps are recorded in Geant4 units in structure-of-arrays buffers that
+    // keep their capacity from event to event; they are converted to
+    // sim::SimEnergyDeposit in one pass at the end of the event.
+    //
+    // Electrons and photons come from `yieldModel`:
+    //  "Geant4" : 10000 electrons/MeV, photons from G4Scintillation (default)
+    //  "Birks"  : recombination R = A / (1 + k dE/dx / (rho E))
+    //             (table Birks: { A: 0.800 k: 0.0486 }, ICARUS)
+    //  "ModBox" : R = ln(A + xi) / xi, xi = B dE/dx / (rho E)
+    //             (table ModBox: { A: 0.930 B: 0.212 mindEdx: 1.5 }, ArgoNeuT);
+    //             below the range of the fit, dE/dx < mindEdx [MeV/cm] (where
+    //             R drops to 0 and below), Birks as configured above
+    //  "NEST"   : NEST-style quanta (W = 19.5 eV shared between ions and
+    //             excitons by `excitationRatio`, 0.21), ions recombining by a
+    //             Thomas-Imel box, xi = C dE/dx E^-p
+    //             (table NEST: { excitationRatio: 0.21 C: 0.25 p: 0.85 })
+    // For Birks and ModBox, electrons = R E_dep / 23.6 eV and photons =
+    // E_dep / 19.5 eV - electrons. The models are evaluated in one pass over
+    // the deposits of the event (dE/dx from the deposit energy and length),
+    // with the electric field E [kV/cm] of the volume (field map, else GDML
+    // auxiliary Efield, else `electricField`, 0.5) at the middle of the
+    // deposit and the density rho (`density`, 1.396 g/cm3).
+    // Geant4 scintillation is then not needed.
+    //
+    // With `scintillation: "Analytic"` the photons are instead the energy
+    // times a yield [photons/MeV] from the table `photonYield`, by particle
+    // type (electron, muon, pion, kaon, proton, alpha, ion, default), with
+    // optional fluctuations `photonFluctuation`: "none", "Poisson" or "Fano"
+    // (gaussian of variance `fanoFactor` times the mean). Fluctuations use
+    // the engine given with SetRandomEngine (larg4Main's ScintEngine).
     class SimEnergyDepositSD : public G4VSensitiveDetector {
     public:
-        SimEnergyDepositSD(G4String);
+        SimEnergyDepositSD(G4String, fhicl::ParameterSet const& config = fhicl::ParameterSet());
         ~SimEnergyDepositSD();
         void Initialize(G4HCofThisEvent*);
+        void EndOfEvent(G4HCofThisEvent*);
+        // builds the hits of the event; called by EndOfEvent unless deferred
+        // (the detector service then calls it, possibly on another thread)
+        void FinalizeEvent();
+        void SetDeferredFinalization(bool defer) { deferFinalization = defer; }
         G4bool ProcessHits(G4Step*, G4TouchableHistory*);
 	const sim::SimEnergyDepositCollection& GetHits() const { return hitCollection; }
+        // moves the hits of the event out of the detector (GetHits() is empty afterwards)
+        sim::SimEnergyDepositCollection ReleaseHits() { return std::exchange(hitCollection, {}); }
+        // offset added to the Geant4 track IDs when an art event is split into sub-events
+        void SetTrackIDOffset(int offset) { trackIDOffset = offset; }
+        // electric field of the volume [kV/cm], used by the yield models
+        void SetElectricField(double field) { electricField = field; }
+        // field map of the volume, used by the yield models instead of the uniform field
+        void SetElectricFieldMap(std::shared_ptr<ElectricFieldMap const> map) { fieldMap = std::move(map); }
+        // engine for the fluctuations of the analytic scintillation yield
+        void SetRandomEngine(CLHEP::HepRandomEngine* engine) { randomEngine = engine; }
+        // does FinalizeEvent draw from the random engine?
+        bool UsesRandomEngine() const { return analyticScintillation && photonFluctuation != kNoFluctuation; }
+        // logs how many steps the deposits of the event merge (not from parallel tasks)
+        void LogCoalescing() const;
     private:
+      enum Coalescing { kNone, kTrack, kVoxel };
+      enum SegmentRule { kUniform, kDEdx };
+      enum YieldModel { kGeant4, kBirks, kModBox, kNEST };
+      enum PhotonFluctuation { kNoFluctuation, kPoisson, kFano };
+      // yield of the analytic scintillation, by particle type
+      enum ParticleClass { kElectron, kMuon, kPion, kKaon, kProton, kAlpha, kIon, kOther, kNParticleClasses };
+
+      // a deposit being built from one or more steps (Geant4 units)
+      struct Deposit {
+        G4ThreeVector start;
+        G4ThreeVector end;
+        double startT;
+        double endT;
+        double edep;
+        int nElectrons;
+        int nPhotons;
+        int trackID;
+        int pdg;
+      };
+      struct VoxelKey {
+        long ix, iy, iz;
+        int trackID;
+        bool operator==(VoxelKey const& o) const
+        { return ix == o.ix && iy == o.iy && iz == o.iz && trackID == o.trackID; }
+      };
+      struct VoxelKeyHash {
+        size_t operator()(VoxelKey const& k) const
+        { return static_cast<size_t>((k.ix * 73856093L) ^ (k.iy * 19349663L) ^ (k.iz * 83492791L)) + 31 * k.trackID; }
+      };
+
+      // the deposits of the event (Geant4 units), one array per quantity
+      struct DepositBuffers {
+        std::vector<double> x0, y0, z0, x1, y1, z1, t0, t1, edep;
+        std::vector<int> nElectrons, nPhotons, trackID, pdg;
+
+        size_t size() const { return edep.size(); }
+        size_t capacity() const { return edep.capacity(); }
+        void push_back(Deposit const& d);
+        void clear();                  // keeps the capacity
+        void reserve(size_t n);
+        void release(size_t n);        // brings the capacity down to n
+      };
+
+      void addDeposit(Deposit const& step);
+      void addSegments(Deposit const& step, G4Step const* aStep);
+      static void merge(Deposit& into, Deposit const& step);
+      void flush();                            // moves the open deposits to the buffers
+      void applyYieldModel();                  // electrons and photons of the buffered deposits
+      void applyPhotonYield();                 // photons of the buffered deposits, analytic yield
+      void convertBuffers();                   // fills hitCollection from the buffers
+
       sim::SimEnergyDepositCollection hitCollection;
+      int trackIDOffset = 0;
+      int processHitsSlot; // timing of ProcessHits
+      bool timeSteps = false; // per-step timing on (the level, read once per event)
+      Coalescing coalescing;
+      double maxLength;    // (configured in cm)
+      double maxTime;      // (configured in ns)
+      double voxelSize;    // (configured in cm)
+      double segmentLength; // (configured in cm)
+      SegmentRule segmentRule;
+      G4EmCalculator emCalculator;   // stopping power for the "dEdx" rule
+      std::vector<double> segmentShare; // cumulative share of the step up to each segment end
+      YieldModel yieldModel;
+      double electricField; // [kV/cm]
+      double density;       // [g/cm3]
+      double yieldA;        // Birks A, ModBox A
+      double yieldB;        // Birks k, ModBox B, NEST C
+      double yieldP;        // NEST p
+      double birksA;        // Birks below the ModBox range
+      double birksK;
+      double modBoxMindEdx; // [MeV/cm]
+      double excitationRatio; // NEST
+      std::shared_ptr<ElectricFieldMap const> fieldMap;
+      std::vector<double> fields;            // field at each deposit [kV/cm]
+      std::vector<double> midX, midY, midZ;  // middle of each deposit [cm]
+      bool analyticScintillation;
+      std::array<double, kNParticleClasses> photonYield; // [photons/MeV]
+      PhotonFluctuation photonFluctuation;
+      double fanoFactor;
+      CLHEP::HepRandomEngine* randomEngine = nullptr;
+      size_t nSteps = 0;   // steps seen in this event
+      size_t nDeposits = 0; // deposits built in this event
+      bool deferFinalization = false;
+      bool finalized = false;
+      bool open = false;   // "track": is `current` being built?
+      Deposit current;
+      std::vector<Deposit> voxels;                                    // "voxel", in order of creation
+      std::unordered_map<VoxelKey, size_t, VoxelKeyHash> voxelIndex;  // "voxel", index in voxels
+      DepositBuffers buffers;
+      size_t expectedDeposits = 0;   // learnt from the previous events, to size the buffers
     };
 
     //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -0,0 +1,138 @@
+// TimingRecorder.h
+//
+// Low-overhead wall-clock accounting of the larg4 hooks.
+//
+// Each instrumented hook owns a slot, registered once by name; timing a call
+// costs two steady_clock reads and two relaxed atomic additions. Hooks called
+// once per event (or per sub-event) are timed at level 1, which is meant to be
+// left on in production; hooks called per track or per step are timed at
+// level 2 only.
+//
+//   static int const slot = larg4::TimingRecorder::instance().slot("MyAction/endOfEventAction");
+//   larg4::ScopedTimer timer(slot);
+//
+// larg4Main sets the level, resets the per-event sums when an event starts,
+// optionally puts them in the event and prints a summary at the end of the
+// job.
+
+#ifndef LARG4_TIMINGRECORDER_H
+#define LARG4_TIMINGRECORDER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace larg4 {
+
+  class TimingRecorder {
+  public:
+    static constexpr int kMaxSlots = 256;
+
+    /// Levels of the hooks
+    enum Level { kOff = 0, kEvent = 1, kStep = 2 };
+
+    static TimingRecorder& instance()
+    {
+      static TimingRecorder recorder;
+      return recorder;
+    }
+
+    /// Returns the slot of the hook with this name, registering it if needed
+    /// (-1 if there are no slots left: the hook is then not timed)
+    int slot(std::string const& name)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (size_t i = 0; i < names_.size(); ++i)
+        if (names_[i] == name) return i;
+      if (names_.size() == kMaxSlots) return -1;
+      names_.push_back(name);
+      return names_.size() - 1;
+    }
+
+    int level() const { return level_.load(std::memory_order_relaxed); }
+    void setLevel(int level) { level_.store(level, std::memory_order_relaxed); }
+
+    void add(int slot, std::chrono::steady_clock::duration elapsed)
+    {
+      auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+      eventNs_[slot].fetch_add(ns, std::memory_order_relaxed);
+      calls_[slot].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// Starts a new event: folds the per-event sums into the job totals
+    void beginEvent()
+    {
+      for (int i = 0; i < kMaxSlots; ++i)
+        totalNs_[i] += eventNs_[i].exchange(0, std::memory_order_relaxed);
+      ++nEvents_;
+    }
+
+    /// Names and times [s] of the hooks that ran in the current event
+    void eventTimes(std::vector<std::string>& names, std::vector<double>& seconds) const
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (size_t i = 0; i < names_.size(); ++i) {
+        std::int64_t const ns = eventNs_[i].load(std::memory_order_relaxed);
+        if (ns == 0) continue;
+        names.push_back(names_[i]);
+        seconds.push_back(ns * 1e-9);
+      }
+    }
+
+    struct Summary {
+      std::string name;
+      std::int64_t calls;
+      double seconds;
+    };
+    /// Totals of the hooks over the job, and the number of events
+    std::vector<Summary> summary(std::int64_t& nEvents) const
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::vector<Summary> result;
+      for (size_t i = 0; i < names_.size(); ++i) {
+        std::int64_t const ns = totalNs_[i] + eventNs_[i].load(std::memory_order_relaxed);
+        result.push_back({names_[i], calls_[i].load(std::memory_order_relaxed), ns * 1e-9});
+      }
+      nEvents = nEvents_;
+      return result;
+    }
+
+  private:
+    TimingRecorder() = default;
+
+    mutable std::mutex mutex_;                            // guards names_
+    std::vector<std::string> names_;
+    std::atomic<int> level_{kEvent};
+    std::array<std::atomic<std::int64_t>, kMaxSlots> eventNs_{};
+    std::array<std::atomic<std::int64_t>, kMaxSlots> calls_{};
+    std::array<std::int64_t, kMaxSlots> totalNs_{};      // only touched by beginEvent (one event at a time)
+    std::int64_t nEvents_ = 0;
+  };
+
+  /// Times its own lifetime into a slot, if the hook level is enabled
+  class ScopedTimer {
+  public:
+    explicit ScopedTimer(int slot, int level = TimingRecorder::kEvent)
+      : slot_((slot >= 0 && TimingRecorder::instance().level() >= level) ? slot : -1)
+    {
+      if (slot_ >= 0) start_ = std::chrono::steady_clock::now();
+    }
+    ~ScopedTimer()
+    {
+      if (slot_ >= 0) TimingRecorder::instance().add(slot_, std::chrono::steady_clock::now() - start_);
+    }
+    ScopedTimer(ScopedTimer const&) = delete;
+    ScopedTimer& operator=(ScopedTimer const&) = delete;
+
+  private:
+    int slot_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+} // namespace larg4
+
+#endif // LARG4_TIMINGRECORDER_H
@@ -0,0 +1,293 @@
+//=============================================================================
+// larg4_check_geometry_cache.cc: round trip of a GDML geometry through the
+// geometry cache of LArG4DetectorService, outside of art.
+//
+// Reads the geometry like LArG4DetectorService, writes its cache, reads the
+// cache back in a fresh process (the Geant4 stores cannot be emptied) and
+// compares what both processes have in their stores: isotopes, elements and
+// materials (with their NIST identity), solids, logical volumes, placements,
+// optical surfaces and the auxiliary information of the volumes.
+//   larg4_check_geometry_cache <gdml file> [--cache FILE]
+// Prints the first difference; the exit status is 1 if the stores differ or
+// the geometry cannot be cached, 2 on error.
+//=============================================================================
+#include "larg4/Services/ContentHash.h"
+#include "larg4/Services/GeometryCache.h"
+
+#include "artg4tk/pluginDetectors/gdml/ColorReader.hh"
+#include "cetlib_except/exception.h"
+
+#include "Geant4/G4Element.hh"
+#include "Geant4/G4GDMLParser.hh"
+#include "Geant4/G4Isotope.hh"
+#include "Geant4/G4LogicalBorderSurface.hh"
+#include "Geant4/G4LogicalSkinSurface.hh"
+#include "Geant4/G4LogicalVolume.hh"
+#include "Geant4/G4LogicalVolumeStore.hh"
+#include "Geant4/G4Material.hh"
+#include "Geant4/G4MaterialPropertiesTable.hh"
+#include "Geant4/G4NistManager.hh"
+#include "Geant4/G4OpticalSurface.hh"
+#include "Geant4/G4PhysicalVolumeStore.hh"
+#include "Geant4/G4VisAttributes.hh"
+#include "Geant4/globals.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+  template <typename S> S const* surfaceOf(S const* s) { return s; }
+  template <typename K, typename S> S const* surfaceOf(std::pair<K const, S*> const& e) { return e.second; }
+
+  void describeProperties(std::ostream& out, G4MaterialPropertiesTable const* table)
+  {
+    if (!table) return;
+    std::vector<G4String> const names = table->GetMaterialPropertyNames();
+    for (auto const& [index, vector]: *table->GetPropertyMap()) {
+      out << "\n  property " << names.at(index);
+      for (size_t i = 0; i < vector->GetVectorLength(); ++i) out << ' ' << vector->Energy(i) << ':' << (*vector)[i];
+    }
+    std::vector<G4String> const constNames = table->GetMaterialConstPropertyNames();
+    for (auto const& [index, value]: *table->GetConstPropertyMap()) {
+      out << "\n  const property " << constNames.at(index) << ' ' << value;
+    }
+  }
+
+  // -- one line per object of the Geant4 stores, in store order; volumes and
+  //    materials are named rather than numbered, doubles are printed exactly
+  std::vector<std::string> describeStores(G4GDMLAuxMapType const& auxMap)
+  {
+    G4NistManager const* nist = G4NistManager::Instance();
+    std::vector<std::string> lines;
+    auto line = []() -> std::ostringstream {
+      std::ostringstream out;
+      out.precision(17);
+      return out;
+    };
+
+    for (G4Isotope const* isotope: *G4Isotope::GetIsotopeTable()) {
+      auto out = line();
+      out << "isotope " << isotope->GetName() << ' ' << isotope->GetZ() << ' ' << isotope->GetN()
+          << ' ' << isotope->GetA();
+      lines.push_back(out.str());
+    }
+    for (G4Element const* element: *G4Element::GetElementTable()) {
+      auto out = line();
+      out << "element " << element->GetName() << ' ' << element->GetSymbol() << ' ' << element->GetZ()
+          << ' ' << element->GetA() << " nist " << (nist->FindElement(G4lrint(element->GetZ())) == element);
+      G4double const* abundances = element->GetRelativeAbundanceVector();
+      for (size_t j = 0; j < element->GetNumberOfIsotopes(); ++j) {
+        out << ' ' << element->GetIsotope(j)->GetName() << ':' << abundances[j];
+      }
+      lines.push_back(out.str());
+    }
+    for (G4Material const* material: *G4Material::GetMaterialTable()) {
+      auto out = line();
+      out << "material " << material->GetName() << " nist " << (nist->FindMaterial(material->GetName()) == material)
+          << " formula '" << material->GetChemicalFormula() << "' density " << material->GetDensity()
+          << " state " << material->GetState() << " temperature " << material->GetTemperature()
+          << " pressure " << material->GetPressure() << " molecule " << material->GetMassOfMolecule()
+          << " mee " << material->GetIonisation()->GetMeanExcitationEnergy();
+      G4double const* fractions = material->GetFractionVector();
+      G4int const* atoms = material->GetAtomsVector();
+      for (size_t i = 0; i < material->GetNumberOfElements(); ++i) {
+        out << ' ' << material->GetElement(i)->GetName() << ':' << fractions[i];
+        if (atoms) out << ':' << atoms[i];
+      }
+      describeProperties(out, material->GetMaterialPropertiesTable());
+      lines.push_back(out.str());
+    }
+
+    for (G4LogicalVolume const* lv: *G4LogicalVolumeStore::GetInstance()) {
+      auto out = line();
+      out << "volume " << lv->GetName() << " material " << lv->GetMaterial()->GetName()
+          << " daughters " << lv->GetNoDaughters() << " solid ";
+      lv->GetSolid()->StreamInfo(out);
+      if (G4VisAttributes const* vis = lv->GetVisAttributes()) {
+        G4Colour const& colour = vis->GetColour();
+        out << " colour " << colour.GetRed() << ' ' << colour.GetGreen() << ' ' << colour.GetBlue()
+            << ' ' << colour.GetAlpha() << " visible " << vis->IsVisible();
+      }
+      lines.push_back(out.str());
+    }
+    for (G4VPhysicalVolume const* pv: *G4PhysicalVolumeStore::GetInstance()) {
+      auto out = line();
+      out << "placement " << pv->GetName() << ' ' << pv->GetCopyNo() << " of " << pv->GetLogicalVolume()->GetName()
+          << " in " << (pv->GetMotherLogical() ? pv->GetMotherLogical()->GetName() : G4String("-"))
+          << " many " << pv->IsMany() << " at " << pv->GetTranslation();
+      if (G4RotationMatrix const* rotation = pv->GetRotation()) {
+        out << " rotation " << rotation->xx() << ' ' << rotation->xy() << ' ' << rotation->xz()
+            << ' ' << rotation->yx() << ' ' << rotation->yy() << ' ' << rotation->yz()
+            << ' ' << rotation->zx() << ' ' << rotation->zy() << ' ' << rotation->zz();
+      }
+      lines.push_back(out.str());
+    }
+
+    auto describeSurface = [](std::ostream& out, G4SurfaceProperty const* property) {
+      auto const surface = dynamic_cast<G4OpticalSurface const*>(property);
+      if (!surface) return;
+      out << " surface " << surface->GetName() << ' ' << surface->GetModel() << ' ' << surface->GetFinish()
+          << ' ' << surface->GetType() << ' ' << surface->GetPolish() << ' ' << surface->GetSigmaAlpha();
+      describeProperties(out, surface->GetMaterialPropertiesTable());
+    };
+    if (G4LogicalBorderSurfaceTable const* borders = G4LogicalBorderSurface::GetSurfaceTable()) {
+      for (auto const& entry: *borders) {
+        G4LogicalBorderSurface const* border = surfaceOf(entry);
+        auto out = line();
+        out << "border " << border->GetName() << ' ' << border->GetVolume1()->GetName()
+            << ' ' << border->GetVolume2()->GetName();
+        describeSurface(out, border->GetSurfaceProperty());
+        lines.push_back(out.str());
+      }
+    }
+    if (G4LogicalSkinSurfaceTable const* skins = G4LogicalSkinSurface::GetSurfaceTable()) {
+      for (auto const& entry: *skins) {
+        G4LogicalSkinSurface const* skin = surfaceOf(entry);
+        auto out = line();
+        out << "skin " << skin->GetName() << ' ' << skin->GetLogicalVolume()->GetName();
+        describeSurface(out, skin->GetSurfaceProperty());
+        lines.push_back(out.str());
+      }
+    }
+
+    // -- the auxiliary map is keyed by address: sorted by volume name
+    std::vector<std::string> auxLines;
+    for (auto const& [lv, auxList]: auxMap) {
+      auto out = line();
+      out << "aux " << lv->GetName();
+      for (auto const& aux: auxList) out << ' ' << aux.type << '=' << aux.value << aux.unit;
+      auxLines.push_back(out.str());
+    }
+    std::sort(auxLines.begin(), auxLines.end());
+    lines.insert(lines.end(), auxLines.begin(), auxLines.end());
+    return lines;
+  }
+
+  // -- the description of the stores of `self --read cache key`, run in a
+  //    process of its own
+  std::vector<std::string> describeCacheRead(std::string const& cacheFile, std::string const& key)
+  {
+    std::cout.flush();
+    G4cout.flush();
+    int fd[2];
+    if (pipe(fd) != 0) {
+      throw cet::exception("larg4_check_geometry_cache") << "Cannot create pipe\n";
+    }
+    pid_t const pid = fork();
+    if (pid < 0) {
+      throw cet::exception("larg4_check_geometry_cache") << "Cannot fork\n";
+    }
+    if (pid == 0) {
+      close(fd[0]);
+      dup2(fd[1], STDOUT_FILENO);
+      close(fd[1]);
+      execl("/proc/self/exe", "larg4_check_geometry_cache", "--read", cacheFile.c_str(), key.c_str(),
+            static_cast<char*>(nullptr));
+      _exit(2);
+    }
+    close(fd[1]);
+    std::string text;
+    char buffer[4096];
+    for (ssize_t n; (n = read(fd[0], buffer, sizeof(buffer))) > 0;) text.append(buffer, n);
+    close(fd[0]);
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      throw cet::exception("larg4_check_geometry_cache") << "Reading " << cacheFile << " failed\n";
+    }
+    std::vector<std::string> lines;
+    std::istringstream in(text);
+    for (std::string l; std::getline(in, l);) {
+      // -- the description lines only; Geant4 prints on stdout too
+      if (l.compare(0, 5, "desc ") == 0) lines.push_back(l.substr(5));
+      else if (!lines.empty() && l.compare(0, 6, "desc+ ") == 0) lines.back() += '\n' + l.substr(6);
+    }
+    return lines;
+  }
+
+  void printDescription(std::vector<std::string> const& lines)
+  {
+    for (auto const& l: lines) {
+      std::istringstream in(l);
+      std::string part;
+      for (bool first = true; std::getline(in, part); first = false) std::cout << (first ? "desc " : "desc+ ") << part << '\n';
+    }
+  }
+
+  int usage()
+  {
+    std::cerr << "usage: larg4_check_geometry_cache <gdml file> [--cache FILE]\n";
+    return 2;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    // -- the second process: build the geometry from the cache and describe it
+    if (argc == 4 && std::string(argv[1]) == "--read") {
+      G4GDMLAuxMapType auxMap;
+      if (!larg4::readGeometryCache(argv[2], argv[3], auxMap)) {
+        throw cet::exception("larg4_check_geometry_cache") << "Cache " << argv[2] << " rejected\n";
+      }
+      printDescription(describeStores(auxMap));
+      return 0;
+    }
+
+    std::string gdmlFile, cacheFile;
+    for (int i = 1; i < argc; ++i) {
+      std::string const arg = argv[i];
+      if (arg == "--cache" && i + 1 < argc) cacheFile = argv[++i];
+      else if (arg[0] != '-' && gdmlFile.empty()) gdmlFile = arg;
+      else return usage();
+    }
+    if (gdmlFile.empty()) return usage();
+    bool const keepCache = !cacheFile.empty();
+    if (!keepCache) cacheFile = "larg4_check_geometry_cache." + std::to_string(getpid()) + ".geometry";
+
+    ColorReader reader;
+    G4GDMLParser parser(&reader);
+    parser.Read(gdmlFile);
+    G4GDMLAuxMapType const auxMap = *parser.GetAuxMap();
+    std::vector<std::string> const parsed = describeStores(auxMap);
+
+    std::string const key = larg4::contentHash(larg4::gdmlContent(gdmlFile));
+    std::string const why = larg4::writeGeometryCache(cacheFile, key, parser.GetWorldVolume(), auxMap);
+    if (!why.empty()) {
+      std::cout << gdmlFile << ": geometry not cached: " << why << "\n";
+      return 1;
+    }
+    std::vector<std::string> cached;
+    try {
+      cached = describeCacheRead(cacheFile, key);
+    }
+    catch (...) {
+      if (!keepCache) std::remove(cacheFile.c_str());
+      throw;
+    }
+    if (!keepCache) std::remove(cacheFile.c_str());
+
+    for (size_t i = 0; i < std::max(parsed.size(), cached.size()); ++i) {
+      std::string const a = (i < parsed.size()) ? parsed[i] : "(nothing)";
+      std::string const b = (i < cached.size()) ? cached[i] : "(nothing)";
+      if (a != b) {
+        std::cout << gdmlFile << ": the cache differs from the GDML read at entry " << i << ":\n"
+                  << "  GDML:  " << a << "\n  cache: " << b << "\n";
+        return 1;
+      }
+    }
+    std::cout << gdmlFile << ": " << parsed.size() << " store entries identical after the cache round trip\n";
+    return 0;
+  }
+  catch (std::exception const& e) {
+    std::cerr << e.what();
+    return 2;
+  }
+}
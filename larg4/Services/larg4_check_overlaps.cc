@@ -0,0 +1,154 @@
+//=============================================================================
+// larg4_check_overlaps.cc: overlap check of a GDML geometry, shared among
+// processes, outside of art.
+//
+// Reads the geometry like LArG4DetectorService and checks its placed volumes
+// for overlaps, the volumes shared among forked processes (Geant4's random
+// engine, used to sample surface points, is not thread safe). Forking is
+// only safe in a process without other threads, hence this tool instead of
+// a parallel check inside the art job. The report is written to the cache
+// directory the service reads (its GeometryCacheDir), so that a job with
+// CheckOverlaps and the same settings uses it instead of checking serially:
+//   larg4_check_overlaps <gdml file> [--resolution N] [--tolerance mm]
+//                        [--jobs N] [--cache-dir DIR] [--report FILE]
+// Prints the report; the exit status is 1 if volumes overlap, 2 on error.
+//=============================================================================
+#include "larg4/Services/OverlapCheck.h"
+
+#include "artg4tk/pluginDetectors/gdml/ColorReader.hh"
+#include "cetlib_except/exception.h"
+
+#include "Geant4/G4GDMLParser.hh"
+#include "Geant4/G4PhysicalVolumeStore.hh"
+#include "Geant4/G4VPhysicalVolume.hh"
+#include "Geant4/globals.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+  // -- the lines of larg4::findOverlaps, the volumes shared among `jobs`
+  //    forked processes
+  std::vector<std::string> findOverlaps(std::vector<G4VPhysicalVolume*> const& volumes,
+                                        size_t jobs, int resolution, double tolerance)
+  {
+    if (jobs <= 1) return larg4::findOverlaps(volumes, 0, 1, resolution, tolerance);
+
+    std::cout.flush();
+    G4cout.flush();
+    std::vector<std::pair<pid_t, int>> children;
+    for (size_t job = 0; job < jobs; ++job) {
+      int fd[2];
+      if (pipe(fd) != 0) {
+        throw cet::exception("larg4_check_overlaps") << "Cannot create pipe\n";
+      }
+      pid_t const pid = fork();
+      if (pid < 0) {
+        throw cet::exception("larg4_check_overlaps") << "Cannot fork\n";
+      }
+      if (pid == 0) { // -- child: check its share, send the lines, leave without cleanup
+        close(fd[0]);
+        int status = 0;
+        try {
+          std::string text;
+          for (auto const& line: larg4::findOverlaps(volumes, job, jobs, resolution, tolerance)) {
+            text += line + '\n';
+          }
+          for (size_t written = 0; written < text.size();) {
+            ssize_t const n = write(fd[1], text.data() + written, text.size() - written);
+            if (n <= 0) { status = 1; break; }
+            written += n;
+          }
+        }
+        catch (...) { status = 1; }
+        _exit(status);
+      }
+      close(fd[1]);
+      children.emplace_back(pid, fd[0]);
+    }
+
+    std::vector<std::string> lines;
+    bool failed = false;
+    for (auto const& [pid, fd]: children) {
+      std::string text;
+      char buffer[4096];
+      for (ssize_t n; (n = read(fd, buffer, sizeof(buffer))) > 0;) text.append(buffer, n);
+      close(fd);
+      int status = 0;
+      if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        failed = true;
+      }
+      std::istringstream in(text);
+      for (std::string line; std::getline(in, line);) lines.push_back(line);
+    }
+    if (failed) {
+      throw cet::exception("larg4_check_overlaps") << "A checking process failed\n";
+    }
+    return lines;
+  }
+
+  int usage()
+  {
+    std::cerr << "usage: larg4_check_overlaps <gdml file> [--resolution N] [--tolerance mm]\n"
+              << "                            [--jobs N] [--cache-dir DIR] [--report FILE]\n";
+    return 2;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::string gdmlFile, cacheDir, reportFile;
+  int resolution = 1000;   // -- the defaults of LArG4DetectorService
+  double tolerance = 0.;
+  long jobs = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::string const arg = argv[i];
+    bool const hasValue = (i + 1 < argc);
+    if (arg == "--resolution" && hasValue) resolution = std::atoi(argv[++i]);
+    else if (arg == "--tolerance" && hasValue) tolerance = std::atof(argv[++i]);
+    else if (arg == "--jobs" && hasValue) jobs = std::atol(argv[++i]);
+    else if (arg == "--cache-dir" && hasValue) cacheDir = argv[++i];
+    else if (arg == "--report" && hasValue) reportFile = argv[++i];
+    else if (arg[0] != '-' && gdmlFile.empty()) gdmlFile = arg;
+    else return usage();
+  }
+  if (gdmlFile.empty() || resolution <= 0) return usage();
+
+  try {
+    ColorReader reader;
+    G4GDMLParser parser(&reader);
+    parser.Read(gdmlFile);
+
+    std::vector<G4VPhysicalVolume*> const volumes(G4PhysicalVolumeStore::GetInstance()->begin(),
+                                                  G4PhysicalVolumeStore::GetInstance()->end());
+    if (jobs <= 0) jobs = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    size_t const nJobs = std::min<size_t>(jobs, std::max<size_t>(volumes.size(), 1));
+    std::string const report = larg4::overlapReport(resolution, tolerance,
+                                                    findOverlaps(volumes, nJobs, resolution, tolerance));
+
+    if (!cacheDir.empty()) {
+      mkdir(cacheDir.c_str(), 0777);
+      std::string const cacheFile = larg4::overlapReportCacheFile(cacheDir, gdmlFile, resolution, tolerance);
+      if (!larg4::storeOverlapReport(cacheFile, report)) {
+        throw cet::exception("larg4_check_overlaps") << "Cannot write " << cacheFile << "\n";
+      }
+      std::cerr << "Overlap check cached in " << cacheFile << "\n";
+    }
+    if (!reportFile.empty() && !larg4::storeOverlapReport(reportFile, report)) {
+      throw cet::exception("larg4_check_overlaps") << "Cannot write " << reportFile << "\n";
+    }
+    std::cout << report;
+    return (larg4::overlapCount(report) > 0) ? 1 : 0;
+  }
+  catch (std::exception const& e) {
+    std::cerr << e.what();
+    return 2;
+  }
+}
@@ -9,11 +9,14 @@
 #include "Geant4/G4ParticleDefinition.hh"
 //
 #include "art/Framework/Principal/Event.h"
+#include "cetlib_except/exception.h"
 #include "nusimdata/SimulationBase/MCTruth.h"
 #include "nusimdata/SimulationBase/MCParticle.h"
 #include "nug4/G4Base/PrimaryParticleInformation.h"
+#include "larg4/Services/TimingRecorder.h"
 #include <iostream>
 #include <cmath>
+#include <numeric>
 #include <CLHEP/Vector/LorentzVector.h>
 using std::string;
 
@@ -23,16 +26,70 @@ larg4::MCTruthEventActionService::
 MCTruthEventActionService(fhicl::ParameterSet const & p)
   : PrimaryGeneratorActionBase(p.get<string>("name", "MCTruthEventActionService")),
   // Initialize our message logger
-  logInfo_("MCTruthEventActionService")
+  logInfo_("MCTruthEventActionService"),
+  fPrimaryRange(0, std::numeric_limits<size_t>::max())
   {
   }
 
+// Split the primaries of the art event into sub-events.
+std::vector<std::pair<size_t, size_t>>
+larg4::MCTruthEventActionService::subEventRanges(art::Event const& evt,
+                                                 std::string const& mode,
+                                                 size_t maxPrimaries) const
+{
+  std::vector< art::Handle< std::vector<simb::MCTruth> > > mclistHandles;
+  evt.getManyByType(mclistHandles);
+
+  // -- count the primaries of each handle exactly as generatePrimaries does
+  std::vector<size_t> perHandle;
+  for (auto const& mclistHandle : mclistHandles) {
+    size_t n = 0;
+    for (auto const& mct : *mclistHandle) {
+      for (int m = 0; m != mct.NParticles(); ++m) {
+        if (mct.GetParticle(m).StatusCode() == 1) ++n;
+      }
+    }
+    perHandle.push_back(n);
+  }
+
+  std::vector<std::pair<size_t, size_t>> ranges;
+  if (mode == "handle") {
+    size_t first = 0;
+    for (size_t n : perHandle) {
+      if (n > 0) ranges.emplace_back(first, first + n);
+      first += n;
+    }
+  }
+  else if (mode == "chunks") {
+    size_t const total = std::accumulate(perHandle.begin(), perHandle.end(), size_t{0});
+    if (total == 0) return ranges;
+    size_t const nChunks = (maxPrimaries == 0) ? 1 : (total + maxPrimaries - 1) / maxPrimaries;
+    // -- balanced: the first (total % nChunks) chunks get one extra primary
+    size_t first = 0;
+    for (size_t c = 0; c < nChunks; ++c) {
+      size_t const n = total / nChunks + ((c < total % nChunks) ? 1 : 0);
+      ranges.emplace_back(first, first + n);
+      first += n;
+    }
+  }
+  else {
+    throw cet::exception("MCTruthEventActionService") << "Unknown sub-event mode: " << mode << "\n";
+  }
+  mf::LogDebug("subEventRanges") << "Split " << mclistHandles.size() << " MCTruth handle(s) into "
+                                 << ranges.size() << " sub-event(s), mode: " << mode;
+  return ranges;
+}
+
 // Create a primary particle for an event!
 // (Standard Art G4 simulation)
 void larg4::MCTruthEventActionService::generatePrimaries(G4Event * anEvent) {
+  static int const timingSlot = TimingRecorder::instance().slot("MCTruthEventAction/generatePrimaries");
+  ScopedTimer timer(timingSlot);
   // For each MCTruth (probably only one, but you never know):
   // index keeps track of which MCTruth object you are using
   size_t index = 0;
+  // flat index of the primary, used to select the current sub-event
+  size_t primary = 0;
   std::map< CLHEP::HepLorentzVector, G4PrimaryVertex* >                  vertexMap;
   std::map< CLHEP::HepLorentzVector, G4PrimaryVertex* >::const_iterator  vi;
   art::ServiceHandle<artg4tk::ActionHolderService> actionHolder;
@@ -69,6 +126,13 @@ void larg4::MCTruthEventActionService::generatePrimaries(G4Event * anEvent) {
           continue;
         }
 
+        // -- only the primaries of the current sub-event
+        if (primary < fPrimaryRange.first || primary >= fPrimaryRange.second) {
+          ++primary;
+          continue;
+        }
+        ++primary;
+
         if( ((m+1)%nPart) < 2 ) // -- only first and last will satisfy this
         {
           mf::LogDebug("generatePrimaries") << "Particle Number:  " << (m+1) << " of " << nPart;
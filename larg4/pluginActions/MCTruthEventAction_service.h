@@ -29,6 +29,10 @@
 #include "Geant4/G4VUserPrimaryGeneratorAction.hh"
 #include "Geant4/G4ParticleTable.hh"
 #include "Geant4/globals.hh"
+
+#include <limits>
+#include <utility>
+#include <vector>
 // nug4 includes
 #include "nug4/G4Base/ConvertMCTruthToG4.h"
 
@@ -54,6 +58,19 @@ namespace larg4 {
 
     virtual void generatePrimaries(G4Event * anEvent) override;
 
+    // Sub-event support: primaries are counted in the order generatePrimaries
+    // visits them (MCTruth handle, MCTruth entry, particle with status 1).
+    // Only primaries with index in [first, last) are pushed into the G4Event.
+    void setPrimaryRange(size_t first, size_t last) { fPrimaryRange = {first, last}; }
+    void resetPrimaryRange() { fPrimaryRange = {0, std::numeric_limits<size_t>::max()}; }
+
+    // Split the primaries of an art event into sub-event ranges, either one
+    // per MCTruth handle ("handle") or into balanced chunks of at most
+    // maxPrimaries primaries ("chunks"). Empty ranges are not returned.
+    std::vector<std::pair<size_t, size_t>> subEventRanges(art::Event const& evt,
+                                                          std::string const& mode,
+                                                          size_t maxPrimaries) const;
+
     // We don't add anything to the event, so we don't need callArtProduces
     // or FillEventWithArtStuff.
 
@@ -63,6 +80,7 @@ namespace larg4 {
     mf::LogInfo logInfo_;
     static G4ParticleTable*           fParticleTable; ///< Geant4's table of particle definitions.
     std::map<G4int, G4int>            fUnknownPDG;    ///< map of unknown PDG codes to instances
+    std::pair<size_t, size_t>         fPrimaryRange;  ///< primaries generated in the current (sub-)event
 
   };
 }//namespace larg4
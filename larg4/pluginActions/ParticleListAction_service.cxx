@@ -6,6 +6,8 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include "larg4/pluginActions/ParticleListAction_service.h"
+#include "larg4/Services/TimingRecorder.h"
+#include "larg4/Services/ProcessRegistry.h"
 #include "nug4/G4Base/PrimaryParticleInformation.h"
 #include "lardataobj/Simulation/sim.h"
 #include "nug4/ParticleNavigation/ParticleList.h"
@@ -40,19 +42,15 @@
 
 #include <algorithm>
 #include <string>
+#include <tuple>
 
 // unused const G4bool debug = false;
 
-// Photon variables defined at each step, for use
-// in temporary velocity bug fix. -wforeman
-double globalTime, velocity_G4, velocity_step;
-bool entra = true;
-
 namespace larg4 {
 
   // Initialize static members.
-  int ParticleListActionService::fCurrentTrackID = sim::NoParticleId;
-  int ParticleListActionService::fTrackIDOffset = 0;
+  thread_local int ParticleListActionService::fCurrentTrackID = sim::NoParticleId;
+  thread_local ParticleListActionService::WorkerState* ParticleListActionService::tlsWorker_ = nullptr;
 
   //----------------------------------------------------------------------------
   // Dropped particle test
@@ -71,9 +69,11 @@ namespace larg4 {
       // Initialize our message logger
       logInfo_("ParticleListActionService"),
       fenergyCut(p.get<double>("EnergyCut",0.0*CLHEP::GeV)),
-      fparticleList(0),
       fstoreTrajectories( p.get<bool>("storeTrajectories",true) ),
       fkeepGenTrajectories( p.get<std::vector<std::string>>("keepGenTrajectories",{})),
+      fNextTrackIDOffset(0),
+      fFirstSubEvent(true),
+      fLastSubEvent(true),
       fKeepEMShowerDaughters( p.get<bool>("keepEMShowerDaughters",true) ),
       fNotStoredPhysics( p.get< std::vector<std::string> >("NotStoredPhysics",{})),
       fkeepOnlyPrimaryFullTraj( p.get<bool>("keepOnlyPrimaryFullTrajectories",false) ),
@@ -83,10 +83,6 @@ namespace larg4 {
       fKeepSecondToLast( p.get<bool>("KeepSecondToLast", false) )
   {
 
-    // Create the particle list that we'll (re-)use during the course
-    // of the Geant4 simulation.
-    fparticleList = new sim::ParticleList;
-
     // -- D.R. If a custom list of not storable physics is provided, use it, otherwise
     //    use the default list. This preserves the behavior of the keepEmShowerDaughters
     //    parameter
@@ -103,7 +99,6 @@ namespace larg4 {
               << " resulting from the following processes: \n{ ";
       for (auto const & i : fNotStoredPhysics) {
         sstored << "\"" << i << "\" ";
-        fNotStoredCounterUMap.emplace(i, 0); // -- initialize counter
       }
       logInfo_ << sstored.str() << "}\n";
 
@@ -125,27 +120,66 @@ namespace larg4 {
   art::Event  *ParticleListActionService::getCurrArtEvent() { return (currentArtEvent_); }
  //----------------------------------------------------------------------------
   // Destructor.
-  ParticleListActionService::~ParticleListActionService()
+  ParticleListActionService::~ParticleListActionService() = default;
+
+  //----------------------------------------------------------------------------
+  // Per-thread state
+  ParticleListActionService::WorkerState::WorkerState()
+    // Create the particle list that we'll (re-)use during the course
+    // of the Geant4 simulation.
+    : fparticleList(std::make_unique<sim::ParticleList>())
+  {}
+
+  void ParticleListActionService::WorkerState::clear()
+  {
+    fCurrentParticle.clear();
+    fHighestTrackID = 0;
+    fHighestListedTrackID = 0;
+    fparticleList->clear();
+    fTracks.clear();
+    fPrimaryTrackIDs.clear();
+    fPrimaryTruthMap.clear();
+    fNotStoredCounterUMap.clear();
+  }
+
+  ParticleListActionService::WorkerState& ParticleListActionService::worker() const
   {
-    // Delete anything that we created with "new'.
-    delete fparticleList;
+    if (!tlsWorker_) {
+      std::lock_guard<std::mutex> lock(fWorkersMutex);
+      fWorkers.push_back(std::make_unique<WorkerState>());
+      tlsWorker_ = fWorkers.back().get();
+    }
+    return *tlsWorker_;
   }
 
   //----------------------------------------------------------------------------
   // Begin the event
   void ParticleListActionService::beginOfEventAction(const G4Event*)
   {
+    static int const timingSlot = TimingRecorder::instance().slot("ParticleListAction/beginOfEventAction");
+    ScopedTimer timer(timingSlot);
+    WorkerState& w = worker();
+
     // Clear any previous particle information.
-    fCurrentParticle.clear();
-    fparticleList->clear();
-    fParentIDMap.clear();
-    fMCTIndexMap.clear();
-    fMCTPrimProcessKeepMap.clear();
+    w.fCurrentParticle.clear();
     fCurrentTrackID = sim::NoParticleId;
 
-    fPrimaryTruthMap.clear();
-    fMCTIndexToGeneratorMap.clear();
-    fNotStoredCounterUMap.clear();
+    {
+      std::lock_guard<std::mutex> lock(fWorkersMutex);
+      // -- first Geant4 event this worker runs for the art event: forget
+      //    the previous art event, but keep accumulating over sub-events
+      if (!w.fActive) {
+        w.clear();
+        w.fActive = true;
+      }
+      // -- track IDs of a sub-event start past those of the previous ones,
+      //    whichever worker simulated them
+      w.fTrackIDOffset = fNextTrackIDOffset;
+    }
+
+    if (!fFirstSubEvent) return;
+
+    fMCTIndexToGenerator.clear();
 
     // -- D.R. If a custom list of keepGenTrajectories is provided, use it, otherwise
     //    keep or drop decision made based storeTrajectories parameter. This preserves
@@ -161,8 +195,9 @@ namespace larg4 {
     // -- D.R. determine mapping between MCTruthIndex(s) and generator(s) for later reference
     art::ServiceHandle<artg4tk::ActionHolderService> actionHolder;
     art::Event & evt = actionHolder->getCurrArtEvent();
-    std::vector< art::Handle< std::vector<simb::MCTruth> > > mclists;
-    evt.getManyByType(mclists);
+    fMCTruthHandles.clear();
+    evt.getManyByType(fMCTruthHandles);
+    auto const& mclists = fMCTruthHandles;
 
     size_t nKeep = 0;
     std::string generator_name = "unknown";
@@ -194,7 +229,7 @@ namespace larg4 {
           }
         }
       }
-      fMCTIndexToGeneratorMap.emplace(mcti, std::make_pair(generator_name, keepGen));
+      fMCTIndexToGenerator.emplace_back(generator_name, keepGen);
       sskeepgen << "\n\tTrajectory points storable : " << (keepGen ? "true" : "false") << "\n";
       mf::LogDebug("beginOfEventAction::Generator") << sskeepgen.str();
     }
@@ -212,21 +247,32 @@ namespace larg4 {
   //-------------------------------------------------------------
   // figure out the ultimate parentage of the particle with track ID
   // trackid
-  // assume that the current track id has already been added to
-  // the fParentIDMap
-  int ParticleListActionService::GetParentage(int trackid) const
+  // assume that the current track id has already been recorded as
+  // dropped
+  int ParticleListActionService::GetParentage(WorkerState& w, int trackid) const
   {
     int parentid = sim::NoParticleId;
 
-    // search the fParentIDMap recursively until we have the parent id
+    // follow the dropped parents until we have the parent id
     // of the first EM particle that led to this one
-    std::map<int,int>::const_iterator itr = fParentIDMap.find(trackid);
-    while( itr != fParentIDMap.end() ){
+    for (int id = trackid;;) {
+      WorkerState::TrackRecord const* record = w.findTrack(id);
+      if (!record || record->droppedParent == WorkerState::kNotDropped) break;
 
       // set the parentid to the current parent ID, when the loop ends
       // this id will be the first EM particle
-      parentid = (*itr).second;
-      itr = fParentIDMap.find(parentid);
+      parentid = id = record->droppedParent;
+    }
+
+    // -- path compression: the tracks on the way now point to that particle.
+    //    A track is recorded as dropped when it starts, before any of its
+    //    descendants, so the answer of a track never changes afterwards.
+    if (parentid != sim::NoParticleId) {
+      for (int id = trackid; id != parentid;) {
+        int& next = w.fTracks[id].droppedParent;
+        id = next;
+        next = parentid;
+      }
     }
 
     return parentid;
@@ -236,6 +282,10 @@ namespace larg4 {
   // Create our initial simb::MCParticle object and add it to the sim::ParticleList.
   void ParticleListActionService::preUserTrackingAction(const G4Track* track)
   {
+    static int const timingSlot = TimingRecorder::instance().slot("ParticleListAction/preUserTrackingAction");
+    ScopedTimer timer(timingSlot, TimingRecorder::kStep);
+    WorkerState& w = worker();
+
      // Particle type.
     G4ParticleDefinition* particleDefinition = track->GetDefinition();
     G4int pdgCode = particleDefinition->GetPDGEncoding();
@@ -244,11 +294,12 @@ namespace larg4 {
     // ID number that we'll use in the ParticleList.
     // It is offset by the number of tracks accumulated from the previous Geant4
     // runs (if any)
-    int const trackID = track->GetTrackID() + fTrackIDOffset;
+    int const trackID = track->GetTrackID() + w.fTrackIDOffset;
     fCurrentTrackID = trackID;
+    if (trackID > w.fHighestTrackID) w.fHighestTrackID = trackID;
 
     // And the particle's parent (same offset as above):
-    int parentID = track->GetParentID() + fTrackIDOffset;
+    int parentID = track->GetParentID() + w.fTrackIDOffset;
 
     std::string process_name = "unknown";
     std::string mct_primary_process = "unknown";
@@ -314,35 +365,45 @@ namespace larg4 {
       // figure out what process is making this track - skip it if it is
       // one of pair production, compton scattering, photoelectric effect
       // bremstrahlung, annihilation, or ionization
-      process_name = track->GetCreatorProcess()->GetProcessName();
+      G4VProcess const* creatorProcess = track->GetCreatorProcess();
+      process_name = creatorProcess->GetProcessName();
       if( !fKeepEMShowerDaughters )
       {
         bool notstore = false;
-        for (auto const& p : fNotStoredPhysics){
-          if (process_name.find(p) != std::string::npos)
-          {
-            notstore = true;
-            mf::LogDebug("NotStoredPhysics") << "Found process : " << process_name;
-
-            int old = 0;
-            auto search = fNotStoredCounterUMap.find(p);
-            if ( search != fNotStoredCounterUMap.end() ){
-              old = search->second;
+        int notStoredIndex = -1;
+        if (ProcessRegistry::instance().built()) {
+          notStoredIndex = ProcessRegistry::instance().flags(creatorProcess).notStoredIndex;
+        }
+        else {
+          for (size_t i = 0; i < fNotStoredPhysics.size(); ++i) {
+            if (process_name.find(fNotStoredPhysics[i]) != std::string::npos) {
+              notStoredIndex = i;
+              break;
             }
-            fNotStoredCounterUMap.insert_or_assign(p, (old+1) );
-
-            break;
           }
         }
+        if (notStoredIndex >= 0)
+        {
+          std::string const& p = fNotStoredPhysics[notStoredIndex];
+          notstore = true;
+          mf::LogDebug("NotStoredPhysics") << "Found process : " << process_name;
+
+          int old = 0;
+          auto search = w.fNotStoredCounterUMap.find(p);
+          if ( search != w.fNotStoredCounterUMap.end() ){
+            old = search->second;
+          }
+          w.fNotStoredCounterUMap.insert_or_assign(p, (old+1) );
+        }
 
         if (notstore)
         {
 
           // figure out the ultimate parentage of this particle
-          // first add this track id and its parent to the fParentIDMap
-          fParentIDMap[trackID] = parentID;
+          // first record this track id as dropped, with its parent
+          w.track(trackID).droppedParent = parentID;
 
-          fCurrentTrackID = -1*this->GetParentage(trackID);
+          fCurrentTrackID = -1*this->GetParentage(w, trackID);
 
           // check that fCurrentTrackID is in the particle list - it is possible
           // that this particle's parent is a particle that did not get tracked.
@@ -351,12 +412,12 @@ namespace larg4 {
           // isn't saved in the particle list because it is below the energy cut
           // which will put a bogus track id value into the sim::IDE object for
           // the sim::SimChannel if we don't check it.
-          if(!fparticleList->KnownParticle(fCurrentTrackID))
+          if(!w.fparticleList->KnownParticle(fCurrentTrackID))
             fCurrentTrackID = sim::NoParticleId;
 
           // clear current particle as we are not stepping this particle and
           // adding trajectory points to it
-          fCurrentParticle.clear();
+          w.fCurrentParticle.clear();
           return;
         } // end if process matches an undesired process
       } // end if keeping EM shower daughters
@@ -365,33 +426,33 @@ namespace larg4 {
       // cut, don't add it to our list.
       G4double energy = track->GetKineticEnergy();
       if( energy < fenergyCut ){
-        fCurrentParticle.clear();
+        w.fCurrentParticle.clear();
 
-        // do add the particle to the parent id map though
+        // do record the particle as dropped though
         // and set the current track id to be it's ultimate parent
-        fParentIDMap[trackID] = parentID;
-        fCurrentTrackID = -1*this->GetParentage(trackID);
+        w.track(trackID).droppedParent = parentID;
+        fCurrentTrackID = -1*this->GetParentage(w, trackID);
 
         return;
       }
 
       // check to see if the parent particle has been stored in the particle navigator
-      // if not, then see if it is possible to walk up the fParentIDMap to find the
+      // if not, then see if it is possible to walk up the dropped parents to find the
       // ultimate parent of this particle.  Use that ID as the parent ID for this
       // particle
-      if( !fparticleList->KnownParticle(parentID) ){
-        // do add the particle to the parent id map
+      if( !w.fparticleList->KnownParticle(parentID) ){
+        // do record the parent of the particle
         // just in case it makes a daughter that we have to track as well
-        fParentIDMap[trackID] = parentID;
-        int pid = this->GetParentage(parentID);
+        w.track(trackID).droppedParent = parentID;
+        int pid = this->GetParentage(w, parentID);
 
         // if we still can't find the parent in the particle navigator,
         // we have to give up
-        if( !fparticleList->KnownParticle(pid) ){
+        if( !w.fparticleList->KnownParticle(pid) ){
           MF_LOG_WARNING("ParticleListActionService")
           << "can't find parent id: "
           << parentID
-          << " in the particle list, or fParentIDMap."
+          << " in the particle list, or among the dropped particles."
           << " Make " << parentID << " the mother ID for"
           << " track ID " << fCurrentTrackID
           << " in the hope that it will aid debugging.";
@@ -401,11 +462,12 @@ namespace larg4 {
       }
 
       // Once the parentID is secured, inherit the MCTruth Index
-      // which should have been set already
-      primarymctIndex = fMCTIndexMap[parentID];
-
-      // Inherit whether the parent is from a primary with MCTruth process_name == "primary"
-      isFromMCTProcessPrimary = fMCTPrimProcessKeepMap[parentID];
+      // which should have been set already, and whether the parent is
+      // from a primary with MCTruth process_name == "primary"
+      if (WorkerState::TrackRecord const* parent = w.findTrack(parentID)) {
+        primarymctIndex = parent->mctIndex;
+        isFromMCTProcessPrimary = parent->fromMCTProcessPrimary;
+      }
 
       // MF_LOG_INFO("SecondaryMCTIndex") << "(trackID, parentID, MCTIndex) = " << trackID
       //                                  << ", " << parentID << ", " << primarymctIndex;
@@ -416,64 +478,73 @@ namespace larg4 {
     double mass = dynamicParticle->GetMass()/CLHEP::GeV;
 
       // Create the sim::Particle object.
-    fCurrentParticle.clear();
-    fCurrentParticle.particle   = new simb::MCParticle( trackID, pdgCode, process_name, parentID, mass);
-    fCurrentParticle.truthIndex = primaryIndex;
+    ParticleInfo_t& currentParticle = w.fCurrentParticle;
+    currentParticle.clear();
+    currentParticle.particle   = new simb::MCParticle( trackID, pdgCode, process_name, parentID, mass);
+    currentParticle.truthIndex = primaryIndex;
 
-    fMCTIndexMap[trackID] = primarymctIndex;
+    WorkerState::TrackRecord& record = w.track(trackID);
+    record.mctIndex = primarymctIndex;
+    record.fromMCTProcessPrimary = isFromMCTProcessPrimary;
 
-    fMCTPrimProcessKeepMap[trackID] = isFromMCTProcessPrimary;
+    bool const keepGen = (primarymctIndex < fMCTIndexToGenerator.size())
+                         && fMCTIndexToGenerator[primarymctIndex].second;
 
 
     // -- determine whether full set of trajectorie points should be stored or only the start and end points
-    fCurrentParticle.keepFullTrajectory = ( !fstoreTrajectories ) ? false :       /*don't want trajectory points at all, bail*/
-                                          ( !(fMCTIndexToGeneratorMap[primarymctIndex].second) ) ? false : /*particle is not from a storable generator*/
+    currentParticle.keepFullTrajectory = ( !fstoreTrajectories ) ? false :       /*don't want trajectory points at all, bail*/
+                                          ( !keepGen ) ? false : /*particle is not from a storable generator*/
                                           ( !fkeepOnlyPrimaryFullTraj ) ? true :  /*want all primaries tracked for a storable generator*/
                                           ( isFromMCTProcessPrimary ) ? true :    /*only descendants from primaries with MCTruth process == "primary"*/
                                           false ;                                 /*not from MCTruth process "primary"*/
 
     // if we are not filtering, we have a decision already
-    if (!fFilter) fCurrentParticle.keep = true;
+    if (!fFilter) currentParticle.keep = true;
 
     // Polarization.
     const G4ThreeVector& polarization = track->GetPolarization();
-    fCurrentParticle.particle->SetPolarization( TVector3( polarization.x(),
+    currentParticle.particle->SetPolarization( TVector3( polarization.x(),
                                                          polarization.y(),
                                                          polarization.z() ) );
 
     // Save the particle in the ParticleList.
-    fparticleList->Add( fCurrentParticle.particle );
+    w.fparticleList->Add( currentParticle.particle );
+    w.fHighestListedTrackID = std::max(w.fHighestListedTrackID, trackID);
   }
 
   //----------------------------------------------------------------------------
   void ParticleListActionService::postUserTrackingAction( const G4Track* aTrack)
   {
-     if (!fCurrentParticle.hasParticle()) return;
+    static int const timingSlot = TimingRecorder::instance().slot("ParticleListAction/postUserTrackingAction");
+    ScopedTimer timer(timingSlot, TimingRecorder::kStep);
+    WorkerState& w = worker();
+    ParticleInfo_t& currentParticle = w.fCurrentParticle;
+     if (!currentParticle.hasParticle()) return;
 
     // if we have found no reason to keep it, drop it!
     // (we might still need parentage information though)
-    if (!fCurrentParticle.keep) {
-      fparticleList->Archive(fCurrentParticle.particle);
+    if (!currentParticle.keep) {
+      w.fparticleList->Archive(currentParticle.particle);
       // after the particle is archived, it is deleted
-      fCurrentParticle.clear();
+      currentParticle.clear();
       return;
     }
 
     if(aTrack){
-      fCurrentParticle.particle->SetWeight(aTrack->GetWeight());
+      currentParticle.particle->SetWeight(aTrack->GetWeight());
 
       // Get the post-step information from the G4Step.
       const G4StepPoint* postStepPoint = aTrack->GetStep()->GetPostStepPoint();
 
       G4String process = postStepPoint->GetProcessDefinedStep()->GetProcessName();
-      fCurrentParticle.particle->SetEndProcess(process);
+      currentParticle.particle->SetEndProcess(process);
 
 
       // -- D.R. Store the final point only for particles that have not had intermediate trajectory
       //    points saved. This avoids double counting the final trajectory point for particles from
       //    generators with storable trajectory points.
 
-      if (!fCurrentParticle.keepFullTrajectory) {
+      if (!currentParticle.keepFullTrajectory) {
         const G4ThreeVector position = postStepPoint->GetPosition();
         G4double time = postStepPoint->GetGlobalTime();
 
@@ -491,19 +562,20 @@ namespace larg4 {
                                energy / CLHEP::GeV );
 
         // Add another point in the trajectory.
-        AddPointToCurrentParticle( fourPos, fourMom, std::string(process) );
+        AddPointToCurrentParticle( w, fourPos, fourMom, std::string(process) );
       }
       // -- particle has a full trajectory, apply SparsifyTrajectory method if enabled
       else if (fSparsifyTrajectories)
       {
-        fCurrentParticle.particle->SparsifyTrajectory(fSparsifyMargin, fKeepSecondToLast);
+        currentParticle.particle->SparsifyTrajectory(fSparsifyMargin, fKeepSecondToLast);
       }
     }
 
     // store truth record pointer, only if it is available
-    if (fCurrentParticle.isPrimary()) {
-      fPrimaryTruthMap[fCurrentParticle.particle->TrackId()]
-        = fCurrentParticle.truthInfoIndex();
+    if (currentParticle.isPrimary()) {
+      int const trackID = currentParticle.particle->TrackId();
+      w.track(trackID).primaryTruth = currentParticle.truthInfoIndex();
+      w.fPrimaryTrackIDs.push_back(trackID);
     }
 
     return;
@@ -514,15 +586,18 @@ namespace larg4 {
   // With every step, add to the particle's trajectory.
   void ParticleListActionService::userSteppingAction(const G4Step* step)
   {
-     if ( !fCurrentParticle.hasParticle() ) {
+    static int const timingSlot = TimingRecorder::instance().slot("ParticleListAction/userSteppingAction");
+    ScopedTimer timer(timingSlot, TimingRecorder::kStep);
+    WorkerState& w = worker();
+     if ( !w.fCurrentParticle.hasParticle() ) {
       return;
     }
 
     // Temporary fix for problem where  DeltaTime on the first step
     // of optical photon propagation is calculated incorrectly. -wforeman
-    globalTime = step->GetTrack()->GetGlobalTime();
-    velocity_G4 = step->GetTrack()->GetVelocity();
-    velocity_step = step->GetStepLength() / step->GetDeltaTime();
+    double const globalTime = step->GetTrack()->GetGlobalTime();
+    double const velocity_G4 = step->GetTrack()->GetVelocity();
+    double const velocity_step = step->GetStepLength() / step->GetDeltaTime();
     if ( (step->GetTrack()->GetDefinition()->GetPDGEncoding()==0) &&
          fabs(velocity_G4 - velocity_step) > 0.0001 ) {
       // Subtract the faulty step time from the global time,
@@ -536,7 +611,7 @@ namespace larg4 {
     // exception: In PreTrackingAction, the correct time information
     // is not available.  So add the correct vertex information here.
 
-    if ( fCurrentParticle.particle->NumberTrajectoryPoints() == 0 ){
+    if ( w.fCurrentParticle.particle->NumberTrajectoryPoints() == 0 ){
 
       // Get the pre/along-step information from the G4Step.
       const G4StepPoint* preStepPoint = step->GetPreStepPoint();
@@ -558,7 +633,7 @@ namespace larg4 {
                              energy / CLHEP::GeV);
 
       // Add the first point in the trajectory.
-      AddPointToCurrentParticle( fourPos, fourMom, "Start" );
+      AddPointToCurrentParticle( w, fourPos, fourMom, "Start" );
 
     } // end if this is the first step
 
@@ -568,8 +643,8 @@ namespace larg4 {
     // trajectory information if we're just updating voxels. To check
     // for this, look at the process name for the step, and compare it
     // against the voxelization process name (set in PhysicsList.cxx).
-    G4String process = step->GetPostStepPoint()->GetProcessDefinedStep()->GetProcessName();
-    G4bool ignoreProcess = process.contains("LArVoxel") || process.contains("OpDetReadout");
+    G4VProcess const* process = step->GetPostStepPoint()->GetProcessDefinedStep();
+    G4bool ignoreProcess = ProcessRegistry::instance().flags(process).ignoredForTrajectories;
 
     /*
     mf::LogDebug("ParticleListActionService::SteppingAction")
@@ -585,7 +660,7 @@ namespace larg4 {
     // what, but whether we store the rest of the trajectory depends
     // on the process, and on a user switch.
     // -- D.R. Store additional trajectory points only for desired generators and processes
-    if ( !ignoreProcess && fCurrentParticle.keepFullTrajectory ){
+    if ( !ignoreProcess && w.fCurrentParticle.keepFullTrajectory ){
 
       // Get the post-step information from the G4Step.
       const G4StepPoint* postStepPoint = step->GetPostStepPoint();
@@ -607,7 +682,7 @@ namespace larg4 {
                              energy / CLHEP::GeV );
 
       // Add another point in the trajectory.
-      AddPointToCurrentParticle( fourPos, fourMom, std::string(process) );
+      AddPointToCurrentParticle( w, fourPos, fourMom, process->GetProcessName() );
      }
   }
 
@@ -664,66 +739,76 @@ namespace larg4 {
   // Returns the ParticleList accumulated during the current event.
   const sim::ParticleList* ParticleListActionService::GetList() const
   {
+    WorkerState& w = worker();
+
     // check if the ParticleNavigator has entries, and if
-    // so grab the highest track id value from it to
+    // so take the highest track id value in it to
     // add to the fTrackIDOffset
-    int highestID = 0;
-    for( auto pn = fparticleList->begin(); pn != fparticleList->end(); pn++)
-      if( (*pn).first > highestID ) highestID = (*pn).first;
+    int const highestID = w.fHighestListedTrackID;
 
     //Only change the fTrackIDOffset if there is in fact a particle to add to the event
-    if( (fparticleList->size())!=0){
-      fTrackIDOffset = highestID + 1;
+    if( (w.fparticleList->size())!=0){
+      w.fTrackIDOffset = highestID + 1;
       mf::LogDebug("GetList:fTrackIDOffset") << "highestID = " << highestID
-                                     << "\nfTrackIDOffset= " << fTrackIDOffset;
+                                     << "\nfTrackIDOffset= " << w.fTrackIDOffset;
     }
 
-    return fparticleList;
+    return w.fparticleList.get();
   }
   //----------------------------------------------------------------------------
 
   simb::GeneratedParticleIndex_t ParticleListActionService::GetPrimaryTruthIndex
-    (int trackId) const
+    (WorkerState const& w, int trackId) const
   {
-    auto const iInfo = GetPrimaryTruthMap().find(trackId);
-    return (iInfo == GetPrimaryTruthMap().end())
-      ? simb::NoGeneratedParticleIndex: iInfo->second;
+    WorkerState::TrackRecord const* record = w.findTrack(trackId);
+    return record ? record->primaryTruth : simb::NoGeneratedParticleIndex;
   } // ParticleListAction::GetPrimaryTruthIndex()
 
+  //----------------------------------------------------------------------------
+  std::map<int, simb::GeneratedParticleIndex_t> const& ParticleListActionService::GetPrimaryTruthMap() const
+  {
+    WorkerState& w = worker();
+    w.fPrimaryTruthMap.clear();
+    for (int trackID: w.fPrimaryTrackIDs)
+      w.fPrimaryTruthMap.emplace(trackID, w.fTracks[trackID].primaryTruth);
+    return w.fPrimaryTruthMap;
+  } // ParticleListAction::GetPrimaryTruthMap()
+
 
   //----------------------------------------------------------------------------
   // Yields the ParticleList accumulated during the current event.
-  sim::ParticleList&& ParticleListActionService::YieldList()
+  sim::ParticleList&& ParticleListActionService::YieldList(WorkerState& w)
   {
     // check if the ParticleNavigator has entries, and if
-    // so grab the highest track id value from it to
+    // so take the highest track id value in it to
     // add to the fTrackIDOffset
-    int highestID = 0;
-    for( auto pn = fparticleList->begin(); pn != fparticleList->end(); pn++)
-      if( (*pn).first > highestID ) highestID = (*pn).first;
+    int const highestID = w.fHighestListedTrackID;
 
     //Only change the fTrackIDOffset if there is in fact a particle to add to the event
-    if( (fparticleList->size())!=0 ){
-      fTrackIDOffset = highestID + 1;
+    if( (w.fparticleList->size())!=0 ){
+      w.fTrackIDOffset = highestID + 1;
       mf::LogDebug("YieldList:fTrackIDOffset") << "highestID = " << highestID
-                                     << "\nfTrackIDOffset= " << fTrackIDOffset;
+                                     << "\nfTrackIDOffset= " << w.fTrackIDOffset;
     }
 
-    return std::move(*fparticleList);
+    // -- the list is moved out
+    w.fHighestListedTrackID = 0;
+    return std::move(*w.fparticleList);
   } // ParticleList&& ParticleListActionService::YieldList()
 
 
   //----------------------------------------------------------------------------
-  void ParticleListActionService::AddPointToCurrentParticle(TLorentzVector const& pos,
+  void ParticleListActionService::AddPointToCurrentParticle(WorkerState& w,
+                                                     TLorentzVector const& pos,
                                                      TLorentzVector const& mom,
                                                      std::string    const& process)
   {
     // Add the first point in the trajectory.
-    fCurrentParticle.particle->AddTrajectoryPoint(pos, mom, process, fKeepTransportation);
+    w.fCurrentParticle.particle->AddTrajectoryPoint(pos, mom, process, fKeepTransportation);
 
     // also see if we can decide to keep the particle
-    if (!fCurrentParticle.keep)
-        fCurrentParticle.keep = fFilter->mustKeep(pos);
+    if (!w.fCurrentParticle.keep)
+        w.fCurrentParticle.keep = fFilter->mustKeep(pos);
 
   } // ParticleListActionService::AddPointToCurrentParticle()
 
@@ -731,11 +816,40 @@ namespace larg4 {
 // event and pass the call on to the action objects.
   void ParticleListActionService::endOfEventAction(const G4Event*)
 {
+  static int const timingSlot = TimingRecorder::instance().slot("ParticleListAction/endOfEventAction");
+  ScopedTimer timer(timingSlot);
+  WorkerState& w = worker();
+
+  // -- more sub-events to come: move the offset past every track ID used so
+  //    far (dropped tracks live on in fTracks) and keep accumulating
+  if (!fLastSubEvent) {
+    std::lock_guard<std::mutex> lock(fWorkersMutex);
+    fNextTrackIDOffset = std::max(fNextTrackIDOffset, w.fHighestTrackID + 1);
+    w.fTrackIDOffset = fNextTrackIDOffset;
+    mf::LogDebug("endOfEventAction:fTrackIDOffset") << "fTrackIDOffset = " << w.fTrackIDOffset;
+    return;
+  }
+
+  // -- the art event is complete: collect the workers that took part in it,
+  //    in a fixed order so that the merged output does not depend on which
+  //    thread simulated what
+  std::vector<WorkerState*> workers;
+  {
+    std::lock_guard<std::mutex> lock(fWorkersMutex);
+    for (auto const& ws: fWorkers)
+      if (ws->fActive) workers.push_back(ws.get());
+    fNextTrackIDOffset = 0;
+  }
+
   // -- End of Run Report
-  if (!fNotStoredCounterUMap.empty()){ // -- Only if there is something to report
+  std::map<std::string, int> notStoredCounter;
+  for (WorkerState const* owner: workers)
+    for (auto const& [process, count] : owner->fNotStoredCounterUMap)
+      notStoredCounter[process] += count;
+  if (!notStoredCounter.empty()){ // -- Only if there is something to report
     std::stringstream sscounter;
     sscounter << "Not Stored Process summary:";
-    for( auto const& [process, count] : fNotStoredCounterUMap ){
+    for( auto const& [process, count] : notStoredCounter ){
       sscounter << "\n\t" << process << " : " << count;
     }
   logInfo_ << sscounter.str();
@@ -743,27 +857,62 @@ namespace larg4 {
 
   partCol_ = std::make_unique<std::vector<simb::MCParticle > >();
   tpassn_ = std::make_unique<art::Assns<simb::MCTruth, simb::MCParticle, sim::GeneratedParticleInfo >>();
-  // Set up the utility class for the "for_each" algorithm.  (We only
-  // need a separate set-up for the utility class because we need to
-  // give it the pointer to the particle list.  We're using the STL
-  // "for_each" instead of the C++ "for loop" because it's supposed
-  // to be faster.
-  UpdateDaughterInformation updateDaughterInformation;
-  updateDaughterInformation.SetParticleList( fparticleList );
-  // Update the daughter information for each particle in the list.
-  std::for_each(fparticleList->begin(),
-                fparticleList->end(),
-                updateDaughterInformation);
+
+  // -- take the particle lists of all the workers, and sort their particles
+  //    by track ID; the worker each particle comes from holds its truth maps
+  std::vector<sim::ParticleList> particleLists;
+  particleLists.reserve(workers.size());
+  std::vector<std::tuple<int, simb::MCParticle*, WorkerState const*>> particles;
+  for (WorkerState* owner: workers) {
+    // Set up the utility class for the "for_each" algorithm.  (We only
+    // need a separate set-up for the utility class because we need to
+    // give it the pointer to the particle list.  We're using the STL
+    // "for_each" instead of the C++ "for loop" because it's supposed
+    // to be faster.
+    UpdateDaughterInformation updateDaughterInformation;
+    updateDaughterInformation.SetParticleList( owner->fparticleList.get() );
+    // Update the daughter information for each particle in the list.
+    std::for_each(owner->fparticleList->begin(),
+                  owner->fparticleList->end(),
+                  updateDaughterInformation);
+
+    particleLists.push_back(YieldList(*owner));
+    for (auto const& iPartPair: particleLists.back()) {
+      if (!iPartPair.second) continue; // archived particle
+      particles.emplace_back(iPartPair.first, iPartPair.second, owner);
+    }
+  }
+  std::sort(particles.begin(), particles.end(),
+            [](auto const& a, auto const& b){ return std::get<0>(a) < std::get<0>(b); });
 
   art::ServiceHandle<ActionHolderService> ahs;
   art::Event * evt= getCurrArtEvent();
-  std::vector< art::Handle< std::vector<simb::MCTruth> > > mclists;
-  evt->getManyByType(mclists);
+  // -- the handles were fetched at the start of the art event
+  auto const& mclists = fMCTruthHandles;
 
   MF_LOG_INFO("endOfEventAction") << "MCTruth Handles Size: " << mclists.size();
 
+  // -- bucket the particles by MCTruthIndex in one pass, keeping the track ID
+  //    order, along with their truth index; a particle without a record goes
+  //    with the first MCTruth handle
+  struct Generated {
+    simb::MCParticle* particle;
+    sim::GeneratedParticleInfo truthInfo;
+  };
+  std::vector<std::vector<Generated>> buckets(mclists.size());
+  for(auto const& [trackID, particle, owner]: particles) {
+    WorkerState::TrackRecord const* record = owner->findTrack(trackID);
+    size_t const gen_index = record? record->mctIndex: 0;
+    if (gen_index >= buckets.size()) continue;
+    buckets[gen_index].push_back({particle, sim::GeneratedParticleInfo{GetPrimaryTruthIndex(*owner, trackID)}});
+  }
+
+  size_t nEntries = 0;
+  for(size_t mcl = 0; mcl < mclists.size(); ++mcl)
+    nEntries += mclists[mcl]->size() * buckets[mcl].size();
+  partCol_->reserve(nEntries);
+
   unsigned int nGeneratedParticles = 0;
-  sim::ParticleList particleList = YieldList();
   for(size_t mcl = 0; mcl < mclists.size(); ++mcl){
     art::Handle< std::vector<simb::MCTruth> > mclistHandle = mclists[mcl];
     MF_LOG_INFO("endOfEventAction") << "mclistHandle Size: " << mclistHandle->size();
@@ -772,40 +921,35 @@ namespace larg4 {
 
       MF_LOG_INFO("endOfEventAction") << "Found " << mct->NParticles() << " particles" ;
 
-      unsigned int HowMany=0;
-      for(auto const& iPartPair: particleList) {
-          simb::MCParticle& p = *(iPartPair.second);
-
-          //if (this->isDropped(&p)) continue;
-
-          auto gen_index = fMCTIndexMap[ p.TrackId() ];
-          if (gen_index == mcl) {
-            ++nGeneratedParticles;
-            ++HowMany;
-
-            sim::GeneratedParticleInfo const truthInfo {
-              GetPrimaryTruthIndex(p.TrackId())
-            };
-            if (!truthInfo.hasGeneratedParticleIndex() && (p.Mother() == 0)) {
-              MF_LOG_WARNING("endOfEvenAction") << "No GeneratedParticleIndex()!";
-              // this means it's primary but with no information; logic error!!
-              art::Exception error(art::errors::LogicError);
-              error << "Failed to match primary particle:\n";
-              error << "\nwith particles from the truth record '"
-                << mclistHandle.provenance()->inputTag() << "':\n";
-              error << "\n";
-              throw error;
-            }
+      for(Generated const& gen: buckets[mcl]) {
+        simb::MCParticle& p = *gen.particle;
+        ++nGeneratedParticles;
+
+        if (!gen.truthInfo.hasGeneratedParticleIndex() && (p.Mother() == 0)) {
+          MF_LOG_WARNING("endOfEvenAction") << "No GeneratedParticleIndex()!";
+          // this means it's primary but with no information; logic error!!
+          art::Exception error(art::errors::LogicError);
+          error << "Failed to match primary particle:\n";
+          error << "\nwith particles from the truth record '"
+            << mclistHandle.provenance()->inputTag() << "':\n";
+          error << "\n";
+          throw error;
+        }
 
-            partCol_->push_back(std::move(p));
-            art::Ptr<simb::MCParticle> mcp_ptr = art::Ptr<simb::MCParticle>(pid_,partCol_->size()-1,evt->productGetter(pid_));
-            tpassn_->addSingle(mct, mcp_ptr, truthInfo);
-          }
-        } // while(particleList)
-        mf::LogDebug("Offset") << "nGeneratedParticles = " << nGeneratedParticles;
+        partCol_->push_back(std::move(p));
+        art::Ptr<simb::MCParticle> mcp_ptr = art::Ptr<simb::MCParticle>(pid_,partCol_->size()-1,evt->productGetter(pid_));
+        tpassn_->addSingle(mct, mcp_ptr, gen.truthInfo);
+      }
+      mf::LogDebug("Offset") << "nGeneratedParticles = " << nGeneratedParticles;
     }
   }
-  ResetTrackIDOffset();
+  fMCTruthHandles.clear();
+
+  // -- the next art event starts from scratch on every worker
+  for (WorkerState* owner: workers) {
+    owner->fTrackIDOffset = 0;
+    owner->fActive = false;
+  }
   // Every ACTION needs to write out their event data now
   ahs -> fillEventWithArtStuff();
   }
@@ -12,6 +12,7 @@
 #define PARTICLELISTACTION_SERVICE_H
 // Includes
 #include "messagefacility/MessageLogger/MessageLogger.h"
+#include "art/Framework/Principal/Handle.h"
 #include "art/Framework/Services/Registry/ServiceMacros.h"
 #include "art/Persistency/Provenance/ModuleDescription.h"
 #include "canvas/Persistency/Common/Assns.h"
@@ -29,7 +30,12 @@
 #include "lardataobj/Simulation/GeneratedParticleInfo.h"
 
 #include "Geant4/globals.hh"
+#include <algorithm>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 // Forward declarations.
 class G4Event;
@@ -91,24 +97,42 @@ namespace larg4 {
     void ParticleFilter(std::unique_ptr<thePositionInVolumeFilter>&& filter)
       { fFilter = std::move(filter); }
 
-    // TrackID of the current particle, EveID if the particle is from an EM shower
+    // TrackID of the current particle, EveID if the particle is from an EM shower.
+    // Refers to the particle tracked by the calling thread.
     static int               GetCurrentTrackID() { return fCurrentTrackID; }
 
-    void                     ResetTrackIDOffset() { fTrackIDOffset = 0;     }
+    void                     ResetTrackIDOffset() { worker().fTrackIDOffset = 0; }
 
-    // Returns the ParticleList accumulated during the current event.
+    // Offset added to the Geant4 track IDs of the current (sub-)event on the
+    // calling thread
+    static int               GetTrackIDOffset() { return tlsWorker_ ? tlsWorker_->fTrackIDOffset : 0; }
+
+    /// When one art event is simulated as several Geant4 sub-events, the
+    /// particle list is accumulated from the first sub-event to the last one
+    /// and the track IDs of each sub-event are offset past the previous ones.
+    /// Products are only built at the end of the last sub-event.
+    void                     setSubEvent(bool first, bool last)
+      { fFirstSubEvent = first; fLastSubEvent = last; }
+
+    // Returns the ParticleList accumulated during the current event by the
+    // calling thread.
     const sim::ParticleList* GetList() const;
 
     /// Returns a map of truth record information index for each of the primary
-    /// particles (by track ID).
-    std::map<int, simb::GeneratedParticleIndex_t> const& GetPrimaryTruthMap() const
-      { return fPrimaryTruthMap; }
+    /// particles (by track ID) tracked by the calling thread (built on each call).
+    std::map<int, simb::GeneratedParticleIndex_t> const& GetPrimaryTruthMap() const;
 
     /// Returns the index of primary truth (`sim::NoGeneratorIndex` if none).
-    simb::GeneratedParticleIndex_t GetPrimaryTruthIndex(int trackId) const;
+    simb::GeneratedParticleIndex_t GetPrimaryTruthIndex(int trackId) const
+      { return GetPrimaryTruthIndex(worker(), trackId); }
+
+    // Yields the ParticleList accumulated during the current event by the
+    // calling thread.
+    sim::ParticleList&& YieldList() { return YieldList(worker()); }
 
-    // Yields the ParticleList accumulated during the current event.
-    sim::ParticleList&& YieldList();
+    /// Physics processes whose products are not stored (only applies if EM
+    /// shower daughters are not kept)
+    std::vector<std::string> const& NotStoredPhysics() const { return fNotStoredPhysics; }
 
     /// returns whether the specified particle has been marked as dropped
     static bool isDropped(simb::MCParticle const* p);
@@ -129,30 +153,91 @@ namespace larg4 {
     //std::unique_ptr <art::Assns<simb::MCTruth, simb::MCParticle >> &GetAssnsMCTruthToMCParticle(){return tpassn_;}
     std::unique_ptr <art::Assns<simb::MCTruth, simb::MCParticle, sim::GeneratedParticleInfo >> &GetAssnsMCTruthToMCParticle(){return tpassn_;}
   private:
+    /// Tracking state of one worker thread. Every thread that runs Geant4
+    /// tracking builds its own particle list and track maps; the lists of all
+    /// the workers taking part in an art event are merged in endOfEventAction.
+    struct WorkerState {
+      ParticleInfo_t           fCurrentParticle;       ///< information about the particle currently being simulated
+                                                       ///< for a single particle.
+      std::unique_ptr<sim::ParticleList> fparticleList; ///< The accumulated particle information for
+                                                       ///< all particles tracked by this worker.
+      int                      fTrackIDOffset = 0;     ///< offset added to track ids when running over
+                                                       ///< multiple MCTruth objects.
+      int                      fHighestTrackID = 0;    ///< highest (offset) track ID seen in the event,
+                                                       ///< including tracks that were not stored
+      int                      fHighestListedTrackID = 0; ///< highest track ID added to fparticleList
+
+      static constexpr int     kNotDropped = -1;       ///< TrackRecord::droppedParent of a kept track
+      /// What is known of a track, by (offset) track ID
+      struct TrackRecord {
+        /// parent ID of a track that is not in the particle list (or whose parent
+        /// is not); path-compressed by GetParentage to the first kept ancestor
+        int droppedParent = kNotDropped;
+        /// index of the MCTruth of the primary ancestor (index of the handle)
+        size_t mctIndex = 0;
+        /// descends from a primary with MCTruth process "primary": keep full trajectory points
+        bool fromMCTProcessPrimary = false;
+        /// index of the primary information in MC truth (primaries only)
+        simb::GeneratedParticleIndex_t primaryTruth = simb::NoGeneratedParticleIndex;
+      };
+      std::vector<TrackRecord> fTracks;                ///< indexed by track ID, grown on demand
+      std::vector<int>         fPrimaryTrackIDs;       ///< tracks with primaryTruth set
+      /// Map: particle track ID -> index of primary information in MC truth
+      /// (only filled by GetPrimaryTruthMap())
+      std::map<int, simb::GeneratedParticleIndex_t> fPrimaryTruthMap;
+      /// Map: not stored process and counter
+      std::unordered_map<std::string, int> fNotStoredCounterUMap;
+      bool                     fActive = false;        ///< took part in the current art event
+
+      WorkerState();
+      /// Forgets everything about the previous event (keeps the offset)
+      void clear();
+
+      /// Record of a track, created (with the records below it) if needed
+      TrackRecord& track(int trackID)
+      {
+        if (size_t(trackID) >= fTracks.size())
+          fTracks.resize(std::max(size_t(trackID) + 1, 2 * fTracks.size()));
+        return fTracks[trackID];
+      }
+      /// Record of a track, nullptr if it has none
+      TrackRecord const* findTrack(int trackID) const
+      { return (trackID >= 0 && size_t(trackID) < fTracks.size()) ? &fTracks[trackID] : nullptr; }
+    };
+
     // A message logger for this action object
     mf::LogInfo logInfo_;
 
-    // this method will loop over the fParentIDMap to get the
-    // parentage of the provided trackid
-    int                      GetParentage(int trackid) const;
+    /// Returns the state of the calling thread, creating it on first use
+    /// (the state is per thread, not part of the service's observable state:
+    /// const accessors use it too)
+    WorkerState&             worker() const;
+
+    // this method will follow the dropped parents of the provided trackid
+    // up to its first kept ancestor, compressing the path on the way
+    int                      GetParentage(WorkerState& w, int trackid) const;
+
+    simb::GeneratedParticleIndex_t GetPrimaryTruthIndex(WorkerState const& w, int trackId) const;
+    sim::ParticleList&&      YieldList(WorkerState& w);
 
     G4double                 fenergyCut;             ///< The minimum energy for a particle to
                                                      ///< be included in the list.
-    ParticleInfo_t           fCurrentParticle;       ///< information about the particle currently being simulated
-                                                     ///< for a single particle.
-    sim::ParticleList*       fparticleList;          ///< The accumulated particle information for
-                                                     ///< all particles in the event.
     G4bool                   fstoreTrajectories;     ///< Whether to store particle trajectories with each particle.
     std::vector<std::string> fkeepGenTrajectories;   ///< List of generators for which fstoreTrejactories applies.
                                                      ///  if not provided and storeTrajectories is true, then all
                                                      ///  trajectories for all generators will be stored. If
                                                      ///  storeTrajectories is set to false, this list is ignored
                                                      ///  and all additional trajectory points are not stored.
-    std::map<int, int>       fParentIDMap;           ///< key is current track ID, value is parent ID
-    static int               fCurrentTrackID;        ///< track ID of the current particle, set to eve ID
+    static thread_local int  fCurrentTrackID;        ///< track ID of the current particle, set to eve ID
                                                      ///< for EM shower particles
-    static int               fTrackIDOffset;         ///< offset added to track ids when running over
-                                                     ///< multiple MCTruth objects.
+    static thread_local WorkerState* tlsWorker_;     ///< state of the calling thread
+    mutable std::vector<std::unique_ptr<WorkerState>> fWorkers; ///< one per thread that ran Geant4 tracking
+    mutable std::mutex       fWorkersMutex;          ///< guards fWorkers, fNextTrackIDOffset and
+                                                     ///< fMCTIndexToGenerator
+    int                      fNextTrackIDOffset;     ///< offset for the next sub-event of the art event,
+                                                     ///< whichever worker simulates it
+    bool                     fFirstSubEvent;         ///< current Geant4 event starts the art event
+    bool                     fLastSubEvent;          ///< current Geant4 event ends the art event
     bool                     fKeepEMShowerDaughters; ///< whether to keep EM shower secondaries, tertiaries, etc
     std::vector<std::string> fNotStoredPhysics;      ///< Physics processes that will not be stored
     bool                     fkeepOnlyPrimaryFullTraj; ///< Whether to store trajectories only for primaries and
@@ -164,20 +249,12 @@ namespace larg4 {
 
     std::unique_ptr<thePositionInVolumeFilter> fFilter; ///< filter for particles to be kept
 
-    /// Map: particle track ID -> index of primary information in MC truth.
-    std::map<int, simb::GeneratedParticleIndex_t> fPrimaryTruthMap;
-
-    /// Map: particle track ID -> index of primary parent in std::vector<simb::MCTruth> object
-    std::map<int, size_t> fMCTIndexMap;
-
-    /// Map: particle trakc ID -> boolean decision to keep or not full trajectory points
-    std::map<int,bool> fMCTPrimProcessKeepMap;
-
-    /// Map: MCTruthIndex -> generator, input label of generator and keepGenerator decision
-    std::map<size_t, std::pair<std::string, G4bool>> fMCTIndexToGeneratorMap;
-
-    /// Map: not stored process and counter
-    std::unordered_map<std::string, int> fNotStoredCounterUMap;
+    /// By MCTruthIndex: input label of the generator and keepGenerator decision
+    /// (shared by all workers, filled at the start of the art event)
+    std::vector<std::pair<std::string, G4bool>> fMCTIndexToGenerator;
+    /// MCTruth handles of the art event, by MCTruthIndex (filled with
+    /// fMCTIndexToGenerator, used again at the end of the art event)
+    std::vector<art::Handle<std::vector<simb::MCTruth>>> fMCTruthHandles;
 
     // Hold on to the current Art event
     art::Event * currentArtEvent_;
@@ -187,7 +264,8 @@ namespace larg4 {
     std::unique_ptr<art::Assns<simb::MCTruth, simb::MCParticle, sim::GeneratedParticleInfo >> tpassn_;
     art::ProductID pid_;
     /// Adds a trajectory point to the current particle, and runs the filter
-    void AddPointToCurrentParticle(TLorentzVector const& pos,
+    void AddPointToCurrentParticle(WorkerState& w,
+                                   TLorentzVector const& pos,
                                    TLorentzVector const& mom,
                                    std::string    const& process);
   };